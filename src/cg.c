@@ -66,6 +66,7 @@ void cg_matrix_init(struct cg_matrix_t * m, double a, double b, double c, double
 	m->a = a;   m->b = b;
 	m->c = c;   m->d = d;
 	m->tx = tx; m->ty = ty;
+	m->type = CG_MATRIX_TYPE_UNKNOWN;
 }
 
 void cg_matrix_init_identity(struct cg_matrix_t * m)
@@ -73,6 +74,7 @@ void cg_matrix_init_identity(struct cg_matrix_t * m)
 	m->a = 1;  m->b = 0;
 	m->c = 0;  m->d = 1;
 	m->tx = 0; m->ty = 0;
+	m->type = CG_MATRIX_TYPE_IDENTITY;
 }
 
 void cg_matrix_init_translate(struct cg_matrix_t * m, double tx, double ty)
@@ -80,6 +82,7 @@ void cg_matrix_init_translate(struct cg_matrix_t * m, double tx, double ty)
 	m->a = 1;   m->b = 0;
 	m->c = 0;   m->d = 1;
 	m->tx = tx; m->ty = ty;
+	m->type = CG_MATRIX_TYPE_UNKNOWN;
 }
 
 void cg_matrix_init_scale(struct cg_matrix_t * m, double sx, double sy)
@@ -87,6 +90,7 @@ void cg_matrix_init_scale(struct cg_matrix_t * m, double sx, double sy)
 	m->a = sx; m->b = 0;
 	m->c = 0;  m->d = sy;
 	m->tx = 0; m->ty = 0;
+	m->type = CG_MATRIX_TYPE_UNKNOWN;
 }
 
 void cg_matrix_init_rotate(struct cg_matrix_t * m, double r)
@@ -97,12 +101,15 @@ void cg_matrix_init_rotate(struct cg_matrix_t * m, double r)
 	m->a = c;   m->b = s;
 	m->c = -s;  m->d = c;
 	m->tx = 0;  m->ty = 0;
+	m->type = CG_MATRIX_TYPE_UNKNOWN;
 }
 
 void cg_matrix_translate(struct cg_matrix_t * m, double tx, double ty)
 {
 	m->tx += m->a * tx + m->c * ty;
 	m->ty += m->b * tx + m->d * ty;
+	if(m->type < CG_MATRIX_TYPE_SCALE)
+		m->type = CG_MATRIX_TYPE_UNKNOWN;
 }
 
 void cg_matrix_scale(struct cg_matrix_t * m, double sx, double sy)
@@ -111,6 +118,8 @@ void cg_matrix_scale(struct cg_matrix_t * m, double sx, double sy)
 	m->b *= sx;
 	m->c *= sy;
 	m->d *= sy;
+	if(m->type < CG_MATRIX_TYPE_AFFINE)
+		m->type = CG_MATRIX_TYPE_UNKNOWN;
 }
 
 void cg_matrix_rotate(struct cg_matrix_t * m, double r)
@@ -130,6 +139,7 @@ void cg_matrix_rotate(struct cg_matrix_t * m, double r)
 	m->b = cb + sd;
 	m->c = cc - sa;
 	m->d = cd - sb;
+	m->type = CG_MATRIX_TYPE_UNKNOWN;
 }
 
 void cg_matrix_multiply(struct cg_matrix_t * m, struct cg_matrix_t * m1, struct cg_matrix_t * m2)
@@ -151,6 +161,7 @@ void cg_matrix_multiply(struct cg_matrix_t * m, struct cg_matrix_t * m1, struct
 		t.tx += m1->ty * m2->c;
 		t.ty += m1->tx * m2->b;
 	}
+	t.type = CG_MATRIX_TYPE_UNKNOWN;
 	memcpy(m, &t, sizeof(struct cg_matrix_t));
 }
 
@@ -161,6 +172,8 @@ void cg_matrix_invert(struct cg_matrix_t * m)
 
 	if((m->c == 0.0) && (m->b == 0.0))
 	{
+		if(m->type == CG_MATRIX_TYPE_IDENTITY)
+			return;
 		m->tx = -m->tx;
 		m->ty = -m->ty;
 		if(m->a != 1.0)
@@ -205,6 +218,38 @@ void cg_matrix_map_point(struct cg_matrix_t * m, struct cg_point_t * p1, struct
 	p2->y = p1->x * m->b + p1->y * m->d + m->ty;
 }
 
+enum cg_matrix_type_t cg_matrix_get_type(struct cg_matrix_t * m)
+{
+	if(m->type == CG_MATRIX_TYPE_UNKNOWN)
+	{
+		if((m->b == 0.0) && (m->c == 0.0))
+		{
+			if((m->a == 1.0) && (m->d == 1.0))
+			{
+				if((m->tx == 0.0) && (m->ty == 0.0))
+					m->type = CG_MATRIX_TYPE_IDENTITY;
+				else if((m->tx == floor(m->tx)) && (m->ty == floor(m->ty)))
+					m->type = CG_MATRIX_TYPE_INTEGER_TRANSLATE;
+				else
+					m->type = CG_MATRIX_TYPE_TRANSLATE;
+			}
+			else
+			{
+				m->type = CG_MATRIX_TYPE_SCALE;
+			}
+		}
+		else if((m->a == 0.0) && (m->d == 0.0))
+		{
+			m->type = CG_MATRIX_TYPE_AXIS_ALIGNED;
+		}
+		else
+		{
+			m->type = CG_MATRIX_TYPE_AFFINE;
+		}
+	}
+	return m->type;
+}
+
 struct cg_surface_t * cg_surface_create(int width, int height)
 {
 	struct cg_surface_t * surface = malloc(sizeof(struct cg_surface_t));
@@ -214,6 +259,9 @@ struct cg_surface_t * cg_surface_create(int width, int height)
 	surface->stride = width << 2;
 	surface->owndata = 1;
 	surface->pixels = calloc(1, (size_t)(height * surface->stride));
+	surface->tracked = 0;
+	surface->opaque = -1;
+	surface->mipmap = NULL;
 	return surface;
 }
 
@@ -226,6 +274,9 @@ struct cg_surface_t * cg_surface_create_for_data(int width, int height, void * p
 	surface->stride = width << 2;
 	surface->owndata = 0;
 	surface->pixels = pixels;
+	surface->tracked = 0;
+	surface->opaque = -1;
+	surface->mipmap = NULL;
 	return surface;
 }
 
@@ -237,6 +288,7 @@ void cg_surface_destroy(struct cg_surface_t * surface)
 		{
 			if(surface->owndata)
 				free(surface->pixels);
+			cg_surface_destroy(surface->mipmap);
 			free(surface);
 		}
 	}
@@ -252,18 +304,152 @@ struct cg_surface_t * cg_surface_reference(struct cg_surface_t * surface)
 	return NULL;
 }
 
-static struct cg_path_t * cg_path_create(void)
+/*
+ * A tracked surface keeps what the library learns about its pixels, whether they are all opaque
+ * and its mip chain, across draws. Drawing through a context keeps that up to date, the caller opting in
+ * promises to call cg_surface_mark_dirty after writing the pixels any other way. Untracked
+ * surfaces, the default, are never assumed opaque
+ */
+void cg_surface_set_tracked(struct cg_surface_t * surface, int tracked)
+{
+	if(surface)
+	{
+		tracked = tracked ? 1 : 0;
+		if(surface->tracked != tracked)
+			cg_surface_mark_dirty(surface);
+		surface->tracked = tracked;
+	}
+}
+
+void cg_surface_mark_dirty(struct cg_surface_t * surface)
+{
+	if(surface)
+	{
+		surface->opaque = -1;
+		if(surface->mipmap)
+		{
+			cg_surface_destroy(surface->mipmap);
+			surface->mipmap = NULL;
+		}
+	}
+}
+
+static int cg_surface_is_opaque(struct cg_surface_t * surface)
+{
+	if(!surface->tracked)
+		return 0;
+	if(surface->opaque < 0)
+	{
+		surface->opaque = 1;
+		for(int y = 0; (y < surface->height) && surface->opaque; y++)
+		{
+			uint32_t * p = (uint32_t *)(surface->pixels + y * surface->stride);
+			for(int x = 0; x < surface->width; x++)
+			{
+				if(p[x] < 0xff000000)
+				{
+					surface->opaque = 0;
+					break;
+				}
+			}
+		}
+	}
+	return surface->opaque;
+}
+
+static inline uint32_t box_pixel(uint32_t p0, uint32_t p1, uint32_t p2, uint32_t p3)
+{
+	uint32_t rb = (p0 & 0xff00ff) + (p1 & 0xff00ff) + (p2 & 0xff00ff) + (p3 & 0xff00ff);
+	uint32_t ag = ((p0 >> 8) & 0xff00ff) + ((p1 >> 8) & 0xff00ff) + ((p2 >> 8) & 0xff00ff) + ((p3 >> 8) & 0xff00ff);
+	return (((ag + 0x20002) << 6) & 0xff00ff00) | (((rb + 0x20002) >> 2) & 0xff00ff);
+}
+
+/*
+ * Returns the next level of the mip chain, half the size rounded up, each pixel the average of
+ * a 2x2 block with the last row and column repeated on odd sizes. Levels are built on first use
+ * and dropped by cg_surface_mark_dirty
+ */
+static struct cg_surface_t * cg_surface_mipmap(struct cg_surface_t * surface)
+{
+	if(!surface->mipmap && ((surface->width > 1) || (surface->height > 1)))
+	{
+		int width = (surface->width + 1) >> 1;
+		int height = (surface->height + 1) >> 1;
+		int pairs = surface->width >> 1;
+		struct cg_surface_t * mipmap = cg_surface_create(width, height);
+		for(int y = 0; y < height; y++)
+		{
+			uint32_t * r0 = (uint32_t *)(surface->pixels + (y << 1) * surface->stride);
+			uint32_t * r1 = (uint32_t *)(surface->pixels + CG_MIN((y << 1) + 1, surface->height - 1) * surface->stride);
+			uint32_t * d = (uint32_t *)(mipmap->pixels + y * mipmap->stride);
+			for(int x = 0; x < pairs; x++)
+				d[x] = box_pixel(r0[x << 1], r0[(x << 1) + 1], r1[x << 1], r1[(x << 1) + 1]);
+			if(pairs < width)
+				d[pairs] = box_pixel(r0[pairs << 1], r0[pairs << 1], r1[pairs << 1], r1[pairs << 1]);
+		}
+		mipmap->opaque = surface->opaque;
+		surface->mipmap = mipmap;
+	}
+	return surface->mipmap;
+}
+
+static void cg_path_measure_destroy(struct cg_path_measure_t * measure);
+static void cg_outline_cache_destroy(struct cg_outline_cache_t * cache);
+
+static inline void cg_path_bounds_reset(struct cg_path_t * path)
+{
+	path->bounds.x1 = HUGE_VAL;
+	path->bounds.y1 = HUGE_VAL;
+	path->bounds.x2 = -HUGE_VAL;
+	path->bounds.y2 = -HUGE_VAL;
+}
+
+static inline void cg_path_bounds_add(struct cg_path_t * path, double x, double y)
+{
+	if(x < path->bounds.x1)
+		path->bounds.x1 = x;
+	if(x > path->bounds.x2)
+		path->bounds.x2 = x;
+	if(y < path->bounds.y1)
+		path->bounds.y1 = y;
+	if(y > path->bounds.y2)
+		path->bounds.y2 = y;
+}
+
+static inline void cg_path_bounds_add_points(struct cg_path_t * path, const struct cg_point_t * points, int count)
+{
+	double x1 = path->bounds.x1, y1 = path->bounds.y1;
+	double x2 = path->bounds.x2, y2 = path->bounds.y2;
+	for(int i = 0; i < count; i++)
+	{
+		x1 = CG_MIN(x1, points[i].x);
+		y1 = CG_MIN(y1, points[i].y);
+		x2 = CG_MAX(x2, points[i].x);
+		y2 = CG_MAX(y2, points[i].y);
+	}
+	path->bounds.x1 = x1; path->bounds.y1 = y1;
+	path->bounds.x2 = x2; path->bounds.y2 = y2;
+}
+
+struct cg_path_t * cg_path_create(void)
 {
 	struct cg_path_t * path = malloc(sizeof(struct cg_path_t));
 	path->contours = 0;
+	path->serial = 0;
 	path->start.x = 0.0;
 	path->start.y = 0.0;
 	cg_array_init(path->elements);
 	cg_array_init(path->points);
+	cg_path_bounds_reset(path);
+	memset(&path->shape, 0, sizeof(path->shape));
+	path->shape.serial = path->serial - 1;
+	path->measure = NULL;
+	path->fill = NULL;
+	path->stroke = NULL;
 	return path;
 }
 
-static void cg_path_destroy(struct cg_path_t * path)
+void cg_path_destroy(struct cg_path_t * path)
 {
 	if(path)
 	{
@@ -271,6 +457,9 @@ static void cg_path_destroy(struct cg_path_t * path)
 			free(path->elements.data);
 		if(path->points.data)
 			free(path->points.data);
+		cg_path_measure_destroy(path->measure);
+		cg_outline_cache_destroy(path->fill);
+		cg_outline_cache_destroy(path->stroke);
 		free(path);
 	}
 }
@@ -289,7 +478,7 @@ static inline void cg_path_get_current_point(struct cg_path_t * path, double * x
 	}
 }
 
-static void cg_path_move_to(struct cg_path_t * path, double x, double y)
+void cg_path_move_to(struct cg_path_t * path, double x, double y)
 {
 	cg_array_ensure(path->elements, 1);
 	cg_array_ensure(path->points, 1);
@@ -297,33 +486,38 @@ static void cg_path_move_to(struct cg_path_t * path, double x, double y)
 	path->elements.data[path->elements.size] = CG_PATH_ELEMENT_MOVE_TO;
 	path->elements.size += 1;
 	path->contours += 1;
+	path->serial += 1;
 	path->points.data[path->points.size].x = x;
 	path->points.data[path->points.size].y = y;
 	path->points.size += 1;
 	path->start.x = x;
 	path->start.y = y;
+	cg_path_bounds_add(path, x, y);
 }
 
-static void cg_path_line_to(struct cg_path_t * path, double x, double y)
+void cg_path_line_to(struct cg_path_t * path, double x, double y)
 {
 	cg_array_ensure(path->elements, 1);
 	cg_array_ensure(path->points, 1);
 
 	path->elements.data[path->elements.size] = CG_PATH_ELEMENT_LINE_TO;
 	path->elements.size += 1;
+	path->serial += 1;
 	path->points.data[path->points.size].x = x;
 	path->points.data[path->points.size].y = y;
 	path->points.size += 1;
+	cg_path_bounds_add(path, x, y);
 }
 
-static void cg_path_curve_to(struct cg_path_t * path, double x1, double y1, double x2, double y2, double x3, double y3)
+void cg_path_curve_to(struct cg_path_t * path, double x1, double y1, double x2, double y2, double x3, double y3)
 {
 	cg_array_ensure(path->elements, 1);
 	cg_array_ensure(path->points, 3);
 
 	path->elements.data[path->elements.size] = CG_PATH_ELEMENT_CURVE_TO;
 	path->elements.size += 1;
-	struct cg_point_t * points = path->points.data + path->points.size;
+	path->serial += 1;
+	struct cg_path_point_t * points = path->points.data + path->points.size;
 	points[0].x = x1;
 	points[0].y = y1;
 	points[1].x = x2;
@@ -331,21 +525,30 @@ static void cg_path_curve_to(struct cg_path_t * path, double x1, double y1, doub
 	points[2].x = x3;
 	points[2].y = y3;
 	path->points.size += 3;
+	cg_path_bounds_add(path, x1, y1);
+	cg_path_bounds_add(path, x2, y2);
+	cg_path_bounds_add(path, x3, y3);
 }
 
-static void cg_path_quad_to(struct cg_path_t * path, double x1, double y1, double x2, double y2)
+void cg_path_quad_to(struct cg_path_t * path, double x1, double y1, double x2, double y2)
 {
-	double x, y;
-	cg_path_get_current_point(path, &x, &y);
+	cg_array_ensure(path->elements, 1);
+	cg_array_ensure(path->points, 2);
 
-	double cx = 2.0 / 3.0 * x1 + 1.0 / 3.0 * x;
-	double cy = 2.0 / 3.0 * y1 + 1.0 / 3.0 * y;
-	double cx1 = 2.0 / 3.0 * x1 + 1.0 / 3.0 * x2;
-	double cy1 = 2.0 / 3.0 * y1 + 1.0 / 3.0 * y2;
-	cg_path_curve_to(path, cx, cy, cx1, cy1, x2, y2);
+	path->elements.data[path->elements.size] = CG_PATH_ELEMENT_QUAD_TO;
+	path->elements.size += 1;
+	path->serial += 1;
+	struct cg_path_point_t * points = path->points.data + path->points.size;
+	points[0].x = x1;
+	points[0].y = y1;
+	points[1].x = x2;
+	points[1].y = y2;
+	path->points.size += 2;
+	cg_path_bounds_add(path, x1, y1);
+	cg_path_bounds_add(path, x2, y2);
 }
 
-static void cg_path_close(struct cg_path_t * path)
+void cg_path_close(struct cg_path_t * path)
 {
 	if(path->elements.size == 0)
 		return;
@@ -355,40 +558,41 @@ static void cg_path_close(struct cg_path_t * path)
 	cg_array_ensure(path->points, 1);
 	path->elements.data[path->elements.size] = CG_PATH_ELEMENT_CLOSE;
 	path->elements.size += 1;
+	path->serial += 1;
 	path->points.data[path->points.size].x = path->start.x;
 	path->points.data[path->points.size].y = path->start.y;
 	path->points.size += 1;
 }
 
-static void cg_path_rel_move_to(struct cg_path_t * path, double dx, double dy)
+void cg_path_rel_move_to(struct cg_path_t * path, double dx, double dy)
 {
 	double x, y;
 	cg_path_get_current_point(path, &x, &y);
 	cg_path_move_to(path, dx + x, dy + y);
 }
 
-static void cg_path_rel_line_to(struct cg_path_t * path, double dx, double dy)
+void cg_path_rel_line_to(struct cg_path_t * path, double dx, double dy)
 {
 	double x, y;
 	cg_path_get_current_point(path, &x, &y);
 	cg_path_line_to(path, dx + x, dy + y);
 }
 
-static void cg_path_rel_curve_to(struct cg_path_t * path, double dx1, double dy1, double dx2, double dy2, double dx3, double dy3)
+void cg_path_rel_curve_to(struct cg_path_t * path, double dx1, double dy1, double dx2, double dy2, double dx3, double dy3)
 {
 	double x, y;
 	cg_path_get_current_point(path, &x, &y);
 	cg_path_curve_to(path, dx1 + x, dy1 + y, dx2 + x, dy2 + y, dx3 + x, dy3 + y);
 }
 
-static void cg_path_rel_quad_to(struct cg_path_t * path, double dx1, double dy1, double dx2, double dy2)
+void cg_path_rel_quad_to(struct cg_path_t * path, double dx1, double dy1, double dx2, double dy2)
 {
 	double x, y;
 	cg_path_get_current_point(path, &x, &y);
 	cg_path_quad_to(path, dx1 + x, dy1 + y, dx2 + x, dy2 + y);
 }
 
-static inline void cg_path_add_rectangle(struct cg_path_t * path, double x, double y, double w, double h)
+void cg_path_add_rectangle(struct cg_path_t * path, double x, double y, double w, double h)
 {
 	cg_path_move_to(path, x, y);
 	cg_path_line_to(path, x + w, y);
@@ -398,8 +602,90 @@ static inline void cg_path_add_rectangle(struct cg_path_t * path, double x, doub
 	cg_path_close(path);
 }
 
-static inline void cg_path_add_round_rectangle(struct cg_path_t * path, double x, double y, double w, double h, double rx, double ry)
+static inline void cg_path_store_points(struct cg_path_point_t * dst, const struct cg_point_t * src, int count)
+{
+#ifdef CG_PATH_SINGLE_PRECISION
+	for(int i = 0; i < count; i++)
+	{
+		dst[i].x = src[i].x;
+		dst[i].y = src[i].y;
+	}
+#else
+	memcpy(dst, src, (size_t)count * sizeof(struct cg_point_t));
+#endif
+}
+
+void cg_path_add_polyline(struct cg_path_t * path, const struct cg_point_t * points, int count, int close)
+{
+	if(count <= 0)
+		return;
+	cg_array_ensure(path->elements, count);
+	cg_array_ensure(path->points, count);
+
+	cg_path_code_t * elements = path->elements.data + path->elements.size;
+	elements[0] = CG_PATH_ELEMENT_MOVE_TO;
+	for(int i = 1; i < count; i++)
+		elements[i] = CG_PATH_ELEMENT_LINE_TO;
+	cg_path_store_points(path->points.data + path->points.size, points, count);
+	cg_path_bounds_add_points(path, points, count);
+
+	path->elements.size += count;
+	path->points.size += count;
+	path->contours += 1;
+	path->serial += 1;
+	path->start = points[0];
+	if(close)
+		cg_path_close(path);
+}
+
+/*
+ * The points are the start point followed by two control points and an end point for each of the count curves
+ */
+void cg_path_add_polycurve(struct cg_path_t * path, const struct cg_point_t * points, int count, int close)
+{
+	if(count < 0)
+		return;
+	cg_array_ensure(path->elements, count + 1);
+	cg_array_ensure(path->points, count * 3 + 1);
+
+	cg_path_code_t * elements = path->elements.data + path->elements.size;
+	elements[0] = CG_PATH_ELEMENT_MOVE_TO;
+	for(int i = 1; i <= count; i++)
+		elements[i] = CG_PATH_ELEMENT_CURVE_TO;
+	cg_path_store_points(path->points.data + path->points.size, points, count * 3 + 1);
+	cg_path_bounds_add_points(path, points, count * 3 + 1);
+
+	path->elements.size += count + 1;
+	path->points.size += count * 3 + 1;
+	path->contours += 1;
+	path->serial += 1;
+	path->start = points[0];
+	if(close)
+		cg_path_close(path);
+}
+
+static inline int cg_path_is_shape(const struct cg_path_t * path)
+{
+	return (path->elements.size > 0) && (path->shape.serial == path->serial);
+}
+
+static inline void cg_path_set_shape(struct cg_path_t * path, int empty, double x, double y, double w, double h, double rx, double ry)
+{
+	if(empty && (w > 0) && (h > 0) && (rx > 0) && (ry > 0))
+	{
+		path->shape.serial = path->serial;
+		path->shape.x = x;
+		path->shape.y = y;
+		path->shape.w = w;
+		path->shape.h = h;
+		path->shape.rx = rx;
+		path->shape.ry = ry;
+	}
+}
+
+void cg_path_add_round_rectangle(struct cg_path_t * path, double x, double y, double w, double h, double rx, double ry)
 {
+	int empty = (path->elements.size == 0);
 	rx = CG_MIN(rx, w * 0.5);
 	ry = CG_MIN(ry, h * 0.5);
 
@@ -418,10 +704,12 @@ static inline void cg_path_add_round_rectangle(struct cg_path_t * path, double x
 	cg_path_curve_to(path, x + rx - cpx, bottom, x, bottom - ry + cpy, x, bottom - ry);
 	cg_path_line_to(path, x, y + ry);
 	cg_path_close(path);
+	cg_path_set_shape(path, empty, x, y, w, h, rx, ry);
 }
 
-static void cg_path_add_ellipse(struct cg_path_t * path, double cx, double cy, double rx, double ry)
+void cg_path_add_ellipse(struct cg_path_t * path, double cx, double cy, double rx, double ry)
 {
+	int empty = (path->elements.size == 0);
 	double left = cx - rx;
 	double top = cy - ry;
 	double right = cx + rx;
@@ -435,9 +723,10 @@ static void cg_path_add_ellipse(struct cg_path_t * path, double cx, double cy, d
 	cg_path_curve_to(path, cx - cpx, bottom, left, cy + cpy, left, cy);
 	cg_path_curve_to(path, left, cy - cpy, cx - cpx, top, cx, top);
 	cg_path_close(path);
+	cg_path_set_shape(path, empty, left, top, rx * 2, ry * 2, rx, ry);
 }
 
-static void cg_path_add_arc(struct cg_path_t * path, double cx, double cy, double r, double a0, double a1, int ccw)
+void cg_path_add_arc(struct cg_path_t * path, double cx, double cy, double r, double a0, double a1, int ccw)
 {
 	double da = a1 - a0;
 	if(fabs(da) > 6.28318530717958647693)
@@ -475,105 +764,149 @@ static void cg_path_add_arc(struct cg_path_t * path, double cx, double cy, doubl
 	}
 }
 
-static inline void cg_path_clear(struct cg_path_t * path)
+void cg_path_clear(struct cg_path_t * path)
 {
 	path->elements.size = 0;
 	path->points.size = 0;
 	path->contours = 0;
+	path->serial += 1;
 	path->start.x = 0.0;
 	path->start.y = 0.0;
+	cg_path_bounds_reset(path);
 }
 
-struct cg_bezier_t {
-	double x1; double y1;
-	double x2; double y2;
-	double x3; double y3;
-	double x4; double y4;
-};
-
-static inline void split(struct cg_bezier_t * b, struct cg_bezier_t * first, struct cg_bezier_t * second)
-{
-	double c = (b->x2 + b->x3) * 0.5;
-	first->x2 = (b->x1 + b->x2) * 0.5;
-	second->x3 = (b->x3 + b->x4) * 0.5;
-	first->x1 = b->x1;
-	second->x4 = b->x4;
-	first->x3 = (first->x2 + c) * 0.5;
-	second->x2 = (second->x3 + c) * 0.5;
-	first->x4 = second->x1 = (first->x3 + second->x2) * 0.5;
-
-	c = (b->y2 + b->y3) * 0.5;
-	first->y2 = (b->y1 + b->y2) * 0.5;
-	second->y3 = (b->y3 + b->y4) * 0.5;
-	first->y1 = b->y1;
-	second->y4 = b->y4;
-	first->y3 = (first->y2 + c) * 0.5;
-	second->y2 = (second->y3 + c) * 0.5;
-	first->y4 = second->y1 = (first->y3 + second->y2) * 0.5;
-}
-
-static inline void flatten(struct cg_path_t * path, struct cg_point_t * p0, struct cg_point_t * p1, struct cg_point_t * p2, struct cg_point_t * p3)
-{
-	struct cg_bezier_t beziers[32];
-	struct cg_bezier_t * b = beziers;
-
-	beziers[0].x1 = p0->x;
-	beziers[0].y1 = p0->y;
-	beziers[0].x2 = p1->x;
-	beziers[0].y2 = p1->y;
-	beziers[0].x3 = p2->x;
-	beziers[0].y3 = p2->y;
-	beziers[0].x4 = p3->x;
-	beziers[0].y4 = p3->y;
-	while(b >= beziers)
-	{
-		double y4y1 = b->y4 - b->y1;
-		double x4x1 = b->x4 - b->x1;
-		double l = fabs(x4x1) + fabs(y4y1);
-		double d;
-		if(l > 1.0)
-		{
-			d = fabs((x4x1) * (b->y1 - b->y2) - (y4y1) * (b->x1 - b->x2)) + fabs((x4x1) * (b->y1 - b->y3) - (y4y1) * (b->x1 - b->x3));
-		}
-		else
-		{
-			d = fabs(b->x1 - b->x2) + fabs(b->y1 - b->y2) + fabs(b->x1 - b->x3) + fabs(b->y1 - b->y3);
-			l = 1.0;
-		}
-		if((d < l * 0.25) || (b == beziers + 31))
-		{
-			cg_path_line_to(path, b->x4, b->y4);
-			--b;
-		}
-		else
-		{
-			split(b, b + 1, b);
-			++b;
-		}
+/*
+ * Wang's formula: a cubic split into n uniform steps stays within tol of its chords when
+ * n >= sqrt(3 / 4 * max(|p0 - 2p1 + p2|, |p1 - 2p2 + p3|) / tol)
+ */
+#define CG_FLATTEN_TOLERANCE	(0.25)
+#define CG_FLATTEN_MAX_SEGMENTS	(1024)
+
+static inline int cubic_segments(const struct cg_point_t * p0, const struct cg_point_t * p1, const struct cg_point_t * p2, const struct cg_point_t * p3)
+{
+	double ddx0 = p0->x - 2 * p1->x + p2->x;
+	double ddy0 = p0->y - 2 * p1->y + p2->y;
+	double ddx1 = p1->x - 2 * p2->x + p3->x;
+	double ddy1 = p1->y - 2 * p2->y + p3->y;
+	double dd = CG_MAX(ddx0 * ddx0 + ddy0 * ddy0, ddx1 * ddx1 + ddy1 * ddy1);
+	double n = ceil(sqrt(sqrt(dd) * (0.75 / CG_FLATTEN_TOLERANCE)));
+	if(!(n < CG_FLATTEN_MAX_SEGMENTS))
+		return CG_FLATTEN_MAX_SEGMENTS;
+	return n < 1 ? 1 : (int)n;
+}
+
+static inline void flatten(struct cg_path_t * path, const struct cg_point_t * p)
+{
+	const struct cg_point_t * p0 = &p[0];
+	const struct cg_point_t * p1 = &p[1];
+	const struct cg_point_t * p2 = &p[2];
+	const struct cg_point_t * p3 = &p[3];
+	int n = cubic_segments(p0, p1, p2, p3);
+	double h = 1.0 / n;
+	double h2 = h * h;
+	double h3 = h2 * h;
+	double ax = 3 * (p1->x - p2->x) + p3->x - p0->x;
+	double ay = 3 * (p1->y - p2->y) + p3->y - p0->y;
+	double bx = 3 * (p0->x - 2 * p1->x + p2->x);
+	double by = 3 * (p0->y - 2 * p1->y + p2->y);
+	double cx = 3 * (p1->x - p0->x);
+	double cy = 3 * (p1->y - p0->y);
+	double x = p0->x;
+	double y = p0->y;
+	double dx = ax * h3 + bx * h2 + cx * h;
+	double dy = ay * h3 + by * h2 + cy * h;
+	double ddx = 6 * ax * h3 + 2 * bx * h2;
+	double ddy = 6 * ay * h3 + 2 * by * h2;
+	double dddx = 6 * ax * h3;
+	double dddy = 6 * ay * h3;
+
+	cg_array_ensure(path->elements, n);
+	cg_array_ensure(path->points, n);
+	cg_path_code_t * elements = path->elements.data + path->elements.size;
+	struct cg_path_point_t * points = path->points.data + path->points.size;
+	for(int i = 0; i < n - 1; i++)
+	{
+		x += dx;
+		y += dy;
+		dx += ddx;
+		dy += ddy;
+		ddx += dddx;
+		ddy += dddy;
+		elements[i] = CG_PATH_ELEMENT_LINE_TO;
+		points[i].x = x;
+		points[i].y = y;
 	}
+	elements[n - 1] = CG_PATH_ELEMENT_LINE_TO;
+	points[n - 1].x = p3->x;
+	points[n - 1].y = p3->y;
+	path->elements.size += n;
+	path->points.size += n;
+	path->serial += 1;
+	cg_path_bounds_add_points(path, p + 1, 3);
 }
 
-static inline struct cg_path_t * cg_path_clone(const struct cg_path_t * path)
+struct cg_path_t * cg_path_clone(const struct cg_path_t * path)
 {
 	struct cg_path_t * result = cg_path_create();
 	cg_array_ensure(result->elements, path->elements.size);
 	cg_array_ensure(result->points, path->points.size);
 
-	memcpy(result->elements.data, path->elements.data, (size_t)path->elements.size * sizeof(enum cg_path_element_t));
-	memcpy(result->points.data, path->points.data, (size_t)path->points.size * sizeof(struct cg_point_t));
+	memcpy(result->elements.data, path->elements.data, (size_t)path->elements.size * sizeof(cg_path_code_t));
+	memcpy(result->points.data, path->points.data, (size_t)path->points.size * sizeof(struct cg_path_point_t));
 
 	result->elements.size = path->elements.size;
 	result->points.size = path->points.size;
 	result->contours = path->contours;
 	result->start = path->start;
+	result->bounds = path->bounds;
+	result->shape = path->shape;
+	result->shape.serial = cg_path_is_shape(path) ? result->serial : result->serial - 1;
 	return result;
 }
 
+void cg_path_add_path(struct cg_path_t * path, const struct cg_path_t * source)
+{
+	int empty = (path->elements.size == 0);
+	int shape = cg_path_is_shape(source);
+	cg_array_ensure(path->elements, source->elements.size);
+	cg_array_ensure(path->points, source->points.size);
+
+	memcpy(path->elements.data + path->elements.size, source->elements.data, (size_t)source->elements.size * sizeof(cg_path_code_t));
+	memcpy(path->points.data + path->points.size, source->points.data, (size_t)source->points.size * sizeof(struct cg_path_point_t));
+
+	path->elements.size += source->elements.size;
+	path->points.size += source->points.size;
+	path->contours += source->contours;
+	path->serial += 1;
+	if(source->elements.size > 0)
+		path->start = source->start;
+	path->bounds.x1 = CG_MIN(path->bounds.x1, source->bounds.x1);
+	path->bounds.y1 = CG_MIN(path->bounds.y1, source->bounds.y1);
+	path->bounds.x2 = CG_MAX(path->bounds.x2, source->bounds.x2);
+	path->bounds.y2 = CG_MAX(path->bounds.y2, source->bounds.y2);
+	if(shape)
+		cg_path_set_shape(path, empty, source->shape.x, source->shape.y, source->shape.w, source->shape.h, source->shape.rx, source->shape.ry);
+}
+
+/*
+ * Elevate the quadratic p[0], q[0], q[1] to the cubic p[0] .. p[3]
+ */
+static inline void quad_to_cubic(struct cg_point_t * p, const struct cg_point_t * q)
+{
+	p[1].x = p[0].x + 2.0 / 3.0 * (q[0].x - p[0].x);
+	p[1].y = p[0].y + 2.0 / 3.0 * (q[0].y - p[0].y);
+	p[2].x = q[1].x + 2.0 / 3.0 * (q[0].x - q[1].x);
+	p[2].y = q[1].y + 2.0 / 3.0 * (q[0].y - q[1].y);
+	p[3].x = q[1].x;
+	p[3].y = q[1].y;
+}
+
 static inline struct cg_path_t * cg_path_clone_flat(struct cg_path_t * path)
 {
-	struct cg_point_t * points = path->points.data;
+	struct cg_path_point_t * points = path->points.data;
 	struct cg_path_t * result = cg_path_create();
-	struct cg_point_t p0;
+	struct cg_point_t p[4];
+	struct cg_point_t q[2];
 
 	cg_array_ensure(result->elements, path->elements.size);
 	cg_array_ensure(result->points, path->points.size);
@@ -590,10 +923,26 @@ static inline struct cg_path_t * cg_path_clone_flat(struct cg_path_t * path)
 			points += 1;
 			break;
 		case CG_PATH_ELEMENT_CURVE_TO:
-			cg_path_get_current_point(result, &p0.x, &p0.y);
-			flatten(result, &p0, points, points + 1, points + 2);
+			cg_path_get_current_point(result, &p[0].x, &p[0].y);
+			for(int j = 0; j < 3; j++)
+			{
+				p[j + 1].x = points[j].x;
+				p[j + 1].y = points[j].y;
+			}
+			flatten(result, p);
 			points += 3;
 			break;
+		case CG_PATH_ELEMENT_QUAD_TO:
+			cg_path_get_current_point(result, &p[0].x, &p[0].y);
+			for(int j = 0; j < 2; j++)
+			{
+				q[j].x = points[j].x;
+				q[j].y = points[j].y;
+			}
+			quad_to_cubic(p, q);
+			flatten(result, p);
+			points += 2;
+			break;
 		case CG_PATH_ELEMENT_CLOSE:
 			cg_path_line_to(result, points[0].x, points[0].y);
 			points += 1;
@@ -635,14 +984,154 @@ static void cg_dash_destroy(struct cg_dash_t * dash)
 	}
 }
 
-static inline struct cg_path_t * cg_dash_path(struct cg_dash_t * dash, struct cg_path_t * path)
+static inline int cg_path_equal(const struct cg_path_t * a, const struct cg_path_t * b)
+{
+	if((a->elements.size != b->elements.size) || (a->points.size != b->points.size))
+		return 0;
+	if(memcmp(a->elements.data, b->elements.data, (size_t)a->elements.size * sizeof(cg_path_code_t)) != 0)
+		return 0;
+	if(memcmp(a->points.data, b->points.data, (size_t)a->points.size * sizeof(struct cg_path_point_t)) != 0)
+		return 0;
+	return 1;
+}
+
+static struct cg_path_measure_t * cg_path_measure_create(void)
+{
+	struct cg_path_measure_t * measure = malloc(sizeof(struct cg_path_measure_t));
+	measure->serial = 0;
+	measure->source = NULL;
+	measure->flat = NULL;
+	cg_array_init(measure->lengths);
+	return measure;
+}
+
+static void cg_path_measure_destroy(struct cg_path_measure_t * measure)
+{
+	if(measure)
+	{
+		cg_path_destroy(measure->source);
+		cg_path_destroy(measure->flat);
+		if(measure->lengths.data)
+			free(measure->lengths.data);
+		free(measure);
+	}
+}
+
+/*
+ * Flatten the path and store the running arc length of every flat point, restarting at each contour.
+ * The result stays on the path until its content changes, so animating the dash offset of an unchanged
+ * path does not flatten it or compute any square root again. A path rebuilt with the same content, as
+ * the current path is on every frame, is recognised by comparing it with the measured copy.
+ */
+static struct cg_path_measure_t * cg_path_measure(struct cg_path_t * path)
+{
+	struct cg_path_measure_t * measure = path->measure;
+	if(!measure)
+	{
+		measure = path->measure = cg_path_measure_create();
+	}
+	else if(measure->serial == path->serial)
+	{
+		return measure;
+	}
+	else if(cg_path_equal(measure->source, path))
+	{
+		measure->serial = path->serial;
+		return measure;
+	}
+	cg_path_destroy(measure->source);
+	cg_path_destroy(measure->flat);
+	measure->source = cg_path_clone(path);
+	measure->flat = cg_path_clone_flat(path);
+
+	struct cg_path_t * flat = measure->flat;
+	struct cg_path_point_t * points = flat->points.data;
+	measure->lengths.size = 0;
+	cg_array_ensure(measure->lengths, flat->points.size);
+	double * lengths = measure->lengths.data;
+	for(int i = 0; i < flat->elements.size; i++)
+	{
+		if(flat->elements.data[i] == CG_PATH_ELEMENT_MOVE_TO)
+		{
+			lengths[i] = 0;
+		}
+		else
+		{
+			double dx = points[i].x - points[i - 1].x;
+			double dy = points[i].y - points[i - 1].y;
+			lengths[i] = lengths[i - 1] + sqrt(dx * dx + dy * dy);
+		}
+	}
+	measure->lengths.size = flat->points.size;
+	measure->serial = path->serial;
+	return measure;
+}
+
+static inline void cg_dash_contour(struct cg_path_t * result, struct cg_dash_t * dash, int toggle, int offset, double phase, struct cg_path_point_t * points, double * lengths, int count)
 {
-	if((dash->data == NULL) || (dash->size <= 0))
-		return cg_path_clone(path);
+	double total = lengths[count - 1];
+	double pos = dash->data[offset] - phase;
+	int i = 0;
+
+	if(toggle)
+		cg_path_move_to(result, points[0].x, points[0].y);
+	while(pos < total)
+	{
+		int lo = i + 1;
+		int hi = count - 1;
+		while(lo < hi)
+		{
+			int mid = (lo + hi) >> 1;
+			if(lengths[mid] > pos)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		int j = lo - 1;
+		double a = (pos - lengths[j]) / (lengths[lo] - lengths[j]);
+		double x = points[j].x + a * (points[lo].x - points[j].x);
+		double y = points[j].y + a * (points[lo].y - points[j].y);
+		if(toggle)
+		{
+			for(int k = i + 1; k <= j; k++)
+				cg_path_line_to(result, points[k].x, points[k].y);
+			cg_path_line_to(result, x, y);
+		}
+		else
+		{
+			cg_path_move_to(result, x, y);
+		}
+		toggle = !toggle;
+		i = j;
+		offset += 1;
+		if(offset == dash->size)
+			offset = 0;
+		pos += dash->data[offset];
+	}
+	if(toggle)
+	{
+		for(int k = i + 1; k < count; k++)
+			cg_path_line_to(result, points[k].x, points[k].y);
+	}
+}
+
+static inline struct cg_path_t * cg_dash_path(struct cg_dash_t * dash, struct cg_path_measure_t * measure)
+{
+	double length = 0;
+	if(dash->data)
+	{
+		for(int i = 0; i < dash->size; i++)
+			length += dash->data[i];
+	}
+	if(length <= 0)
+		return cg_path_clone(measure->source);
 
 	int toggle = 1;
 	int offset = 0;
-	double phase = dash->offset;
+	double period = (dash->size & 1) ? length * 2 : length;
+	double phase = fmod(dash->offset, period);
+	if(phase < 0)
+		phase += period;
 	while(phase >= dash->data[offset])
 	{
 		toggle = !toggle;
@@ -652,57 +1141,21 @@ static inline struct cg_path_t * cg_dash_path(struct cg_dash_t * dash, struct cg
 			offset = 0;
 	}
 
-	struct cg_path_t * flat = cg_path_clone_flat(path);
+	struct cg_path_t * flat = measure->flat;
 	struct cg_path_t * result = cg_path_create();
 	cg_array_ensure(result->elements, flat->elements.size);
 	cg_array_ensure(result->points, flat->points.size);
 
-	enum cg_path_element_t * elements = flat->elements.data;
-	enum cg_path_element_t * end = elements + flat->elements.size;
-	struct cg_point_t * points = flat->points.data;
-	while(elements < end)
-	{
-		int itoggle = toggle;
-		int ioffset = offset;
-		double iphase = phase;
-		double x0 = points->x;
-		double y0 = points->y;
-		if(itoggle)
-			cg_path_move_to(result, x0, y0);
-		++elements;
-		++points;
-		while((elements < end) && (*elements == CG_PATH_ELEMENT_LINE_TO))
-		{
-			double dx = points->x - x0;
-			double dy = points->y - y0;
-			double dist0 = sqrt(dx * dx + dy * dy);
-			double dist1 = 0;
-			while(dist0 - dist1 > dash->data[ioffset] - iphase)
-			{
-				dist1 += dash->data[ioffset] - iphase;
-				double a = dist1 / dist0;
-				double x = x0 + a * dx;
-				double y = y0 + a * dy;
-				if(itoggle)
-					cg_path_line_to(result, x, y);
-				else
-					cg_path_move_to(result, x, y);
-				itoggle = !itoggle;
-				iphase = 0;
-				ioffset += 1;
-				if(ioffset == dash->size)
-					ioffset = 0;
-			}
-			iphase += dist0 - dist1;
-			x0 = points->x;
-			y0 = points->y;
-			if(itoggle)
-				cg_path_line_to(result, x0, y0);
-			++elements;
-			++points;
-		}
+	int n = flat->elements.size;
+	int i = 0;
+	while(i < n)
+	{
+		int count = 1;
+		while((i + count < n) && (flat->elements.data[i + count] == CG_PATH_ELEMENT_LINE_TO))
+			count++;
+		cg_dash_contour(result, dash, toggle, offset, phase, flat->points.data + i, measure->lengths.data + i, count);
+		i += count;
 	}
-	cg_path_destroy(flat);
 	return result;
 }
 
@@ -735,46 +1188,51 @@ static void ft_outline_init(XCG_FT_Outline * outline, struct cg_ctx_t * ctx, int
 	outline->flags = 0x0;
 }
 
-#define FT_COORD(x)			(XCG_FT_Pos)((x) * 64)
-static void ft_outline_move_to(XCG_FT_Outline * ft, double x, double y)
+/*
+ * Map points to 26.6 fixed point outline coordinates, i.e. (XCG_FT_Pos)(p * m * 64). Scaling the
+ * matrix by 64 is exact, so the results match a per point map and convert, while the loops are left
+ * free of branches and calls for the vectorizer. Each matrix type gets its own loop.
+ */
+static void __cg_matrix_map_points_fixed(XCG_FT_Vector * dst, const struct cg_path_point_t * src, int count, struct cg_matrix_t * m)
 {
-	ft->points[ft->n_points].x = FT_COORD(x);
-	ft->points[ft->n_points].y = FT_COORD(y);
-	ft->tags[ft->n_points] = XCG_FT_CURVE_TAG_ON;
-	if(ft->n_points)
+	double a = m->a * 64, b = m->b * 64;
+	double c = m->c * 64, d = m->d * 64;
+	double tx = m->tx * 64, ty = m->ty * 64;
+
+	switch(cg_matrix_get_type(m))
 	{
-		ft->contours[ft->n_contours] = ft->n_points - 1;
-		ft->n_contours++;
+	case CG_MATRIX_TYPE_IDENTITY:
+		for(int i = 0; i < count; i++)
+		{
+			dst[i].x = (XCG_FT_Pos)(src[i].x * 64);
+			dst[i].y = (XCG_FT_Pos)(src[i].y * 64);
+		}
+		break;
+	case CG_MATRIX_TYPE_INTEGER_TRANSLATE:
+	case CG_MATRIX_TYPE_TRANSLATE:
+		for(int i = 0; i < count; i++)
+		{
+			dst[i].x = (XCG_FT_Pos)(src[i].x * 64 + tx);
+			dst[i].y = (XCG_FT_Pos)(src[i].y * 64 + ty);
+		}
+		break;
+	case CG_MATRIX_TYPE_SCALE:
+		for(int i = 0; i < count; i++)
+		{
+			dst[i].x = (XCG_FT_Pos)(src[i].x * a + tx);
+			dst[i].y = (XCG_FT_Pos)(src[i].y * d + ty);
+		}
+		break;
+	default:
+		for(int i = 0; i < count; i++)
+		{
+			dst[i].x = (XCG_FT_Pos)(src[i].x * a + src[i].y * c + tx);
+			dst[i].y = (XCG_FT_Pos)(src[i].x * b + src[i].y * d + ty);
+		}
+		break;
 	}
-	ft->contours_flag[ft->n_contours] = 1;
-	ft->n_points++;
-}
-
-static void ft_outline_line_to(XCG_FT_Outline * ft, double x, double y)
-{
-	ft->points[ft->n_points].x = FT_COORD(x);
-	ft->points[ft->n_points].y = FT_COORD(y);
-	ft->tags[ft->n_points] = XCG_FT_CURVE_TAG_ON;
-	ft->n_points++;
-}
-
-static void ft_outline_curve_to(XCG_FT_Outline * ft, double x1, double y1, double x2, double y2, double x3, double y3)
-{
-	ft->points[ft->n_points].x = FT_COORD(x1);
-	ft->points[ft->n_points].y = FT_COORD(y1);
-	ft->tags[ft->n_points] = XCG_FT_CURVE_TAG_CUBIC;
-	ft->n_points++;
-
-	ft->points[ft->n_points].x = FT_COORD(x2);
-	ft->points[ft->n_points].y = FT_COORD(y2);
-	ft->tags[ft->n_points] = XCG_FT_CURVE_TAG_CUBIC;
-	ft->n_points++;
-
-	ft->points[ft->n_points].x = FT_COORD(x3);
-	ft->points[ft->n_points].y = FT_COORD(y3);
-	ft->tags[ft->n_points] = XCG_FT_CURVE_TAG_ON;
-	ft->n_points++;
 }
+extern __typeof(__cg_matrix_map_points_fixed) cg_matrix_map_points_fixed __attribute__((weak, alias("__cg_matrix_map_points_fixed")));
 
 static void ft_outline_close(XCG_FT_Outline * ft)
 {
@@ -798,45 +1256,67 @@ static void ft_outline_end(XCG_FT_Outline * ft)
 	}
 }
 
+/*
+ * Element codes only decide tags and contour ends, so the tags of a run up to the next close are
+ * written first and all of its points are then mapped with a single batched call.
+ */
 static void ft_outline_convert(XCG_FT_Outline * outline, struct cg_ctx_t * ctx, struct cg_path_t * path, struct cg_matrix_t * matrix)
 {
 	ft_outline_init(outline, ctx, path->points.size, path->contours);
-	enum cg_path_element_t * elements = path->elements.data;
-	struct cg_point_t * points = path->points.data;
-	struct cg_point_t p[3];
-	for(int i = 0; i < path->elements.size; i++)
+	cg_path_code_t * elements = path->elements.data;
+	struct cg_path_point_t * points = path->points.data;
+	char * tags = outline->tags;
+	int i = 0;
+	while(i < path->elements.size)
 	{
-		switch(elements[i])
+		if(elements[i] == CG_PATH_ELEMENT_CLOSE)
 		{
-		case CG_PATH_ELEMENT_MOVE_TO:
-			cg_matrix_map_point(matrix, &points[0], &p[0]);
-			ft_outline_move_to(outline, p[0].x, p[0].y);
-			points += 1;
-			break;
-		case CG_PATH_ELEMENT_LINE_TO:
-			cg_matrix_map_point(matrix, &points[0], &p[0]);
-			ft_outline_line_to(outline, p[0].x, p[0].y);
-			points += 1;
-			break;
-		case CG_PATH_ELEMENT_CURVE_TO:
-			cg_matrix_map_point(matrix, &points[0], &p[0]);
-			cg_matrix_map_point(matrix, &points[1], &p[1]);
-			cg_matrix_map_point(matrix, &points[2], &p[2]);
-			ft_outline_curve_to(outline, p[0].x, p[0].y, p[1].x, p[1].y, p[2].x, p[2].y);
-			points += 3;
-			break;
-		case CG_PATH_ELEMENT_CLOSE:
 			ft_outline_close(outline);
 			points += 1;
-			break;
+			i++;
+			continue;
+		}
+		int start = outline->n_points;
+		int n = start;
+		for(; (i < path->elements.size) && (elements[i] != CG_PATH_ELEMENT_CLOSE); i++)
+		{
+			switch(elements[i])
+			{
+			case CG_PATH_ELEMENT_MOVE_TO:
+				if(n)
+				{
+					outline->contours[outline->n_contours] = n - 1;
+					outline->n_contours++;
+				}
+				outline->contours_flag[outline->n_contours] = 1;
+				tags[n++] = XCG_FT_CURVE_TAG_ON;
+				break;
+			case CG_PATH_ELEMENT_LINE_TO:
+				tags[n++] = XCG_FT_CURVE_TAG_ON;
+				break;
+			case CG_PATH_ELEMENT_CURVE_TO:
+				tags[n++] = XCG_FT_CURVE_TAG_CUBIC;
+				tags[n++] = XCG_FT_CURVE_TAG_CUBIC;
+				tags[n++] = XCG_FT_CURVE_TAG_ON;
+				break;
+			case CG_PATH_ELEMENT_QUAD_TO:
+				tags[n++] = XCG_FT_CURVE_TAG_CONIC;
+				tags[n++] = XCG_FT_CURVE_TAG_ON;
+				break;
+			default:
+				break;
+			}
 		}
+		cg_matrix_map_points_fixed(outline->points + start, points, n - start, matrix);
+		outline->n_points = n;
+		points += n - start;
 	}
 	ft_outline_end(outline);
 }
 
 static void ft_outline_convert_dash(XCG_FT_Outline * outline, struct cg_ctx_t * ctx, struct cg_path_t * path, struct cg_matrix_t * matrix, struct cg_dash_t * dash)
 {
-	struct cg_path_t * dashed = cg_dash_path(dash, path);
+	struct cg_path_t * dashed = cg_dash_path(dash, cg_path_measure(path));
 	ft_outline_convert(outline, ctx, dashed, matrix);
 	cg_path_destroy(dashed);
 }
@@ -870,132 +1350,492 @@ static void cg_rle_destroy(struct cg_rle_t * rle)
 	}
 }
 
-static void cg_rle_rasterize(struct cg_ctx_t * ctx, struct cg_rle_t * rle, struct cg_path_t * path, struct cg_matrix_t * m, struct cg_rect_t * clip, struct cg_stroke_data_t * stroke, enum cg_fill_rule_t winding)
+static void cg_rle_update_extents(struct cg_rle_t * rle)
 {
-	XCG_FT_Raster_Params params;
-	params.flags = XCG_FT_RASTER_FLAG_DIRECT | XCG_FT_RASTER_FLAG_AA;
-	params.gray_spans = generation_callback;
-	params.user = rle;
-	if(clip)
+	if(rle->spans.size == 0)
 	{
-		params.flags |= XCG_FT_RASTER_FLAG_CLIP;
-		params.clip_box.xMin = (XCG_FT_Pos)(clip->x);
-		params.clip_box.yMin = (XCG_FT_Pos)(clip->y);
-		params.clip_box.xMax = (XCG_FT_Pos)(clip->x + clip->w);
-		params.clip_box.yMax = (XCG_FT_Pos)(clip->y + clip->h);
-	}
+		rle->x = 0;
+		rle->y = 0;
+		rle->w = 0;
+		rle->h = 0;
+		return;
+	}
+
+	/*
+	 * Spans of one rasterization are sorted by y, but instanced batches append
+	 * whole runs after each other, so every span is looked at
+	 */
+	struct cg_span_t * spans = rle->spans.data;
+	int x1 = INT_MAX;
+	int y1 = INT_MAX;
+	int x2 = INT_MIN;
+	int y2 = INT_MIN;
+	for(int i = 0; i < rle->spans.size; i++)
+	{
+		if(spans[i].x < x1)
+			x1 = spans[i].x;
+		if(spans[i].x + spans[i].len > x2)
+			x2 = spans[i].x + spans[i].len;
+		if(spans[i].y < y1)
+			y1 = spans[i].y;
+		if(spans[i].y > y2)
+			y2 = spans[i].y;
+	}
+
+	rle->x = x1;
+	rle->y = y1;
+	rle->w = x2 - x1;
+	rle->h = y2 - y1 + 1;
+}
+
+/*
+ * The stroker works in device space with a single width, scaled by the length of the mapped diagonal
+ */
+static inline double cg_matrix_stroke_scale(struct cg_matrix_t * m)
+{
+	if(cg_matrix_get_type(m) <= CG_MATRIX_TYPE_TRANSLATE)
+		return 1.0;
+
+	struct cg_point_t p1 = { 0, 0 };
+	struct cg_point_t p2 = { 1.41421356237309504880, 1.41421356237309504880 };
+	struct cg_point_t p3;
+
+	cg_matrix_map_point(m, &p1, &p1);
+	cg_matrix_map_point(m, &p2, &p2);
+
+	p3.x = p2.x - p1.x;
+	p3.y = p2.y - p1.y;
+
+	return sqrt(p3.x * p3.x + p3.y * p3.y) / 2.0;
+}
+
+static void ft_outline_stroke(XCG_FT_Outline * outline, struct cg_ctx_t * ctx, struct cg_path_t * path, struct cg_matrix_t * m, struct cg_stroke_data_t * stroke)
+{
+	if(stroke->dash == NULL)
+		ft_outline_convert(outline, ctx, path, m);
+	else
+		ft_outline_convert_dash(outline, ctx, path, m, stroke->dash);
+	XCG_FT_Stroker_LineCap ftCap;
+	XCG_FT_Stroker_LineJoin ftJoin;
+	XCG_FT_Fixed ftWidth;
+	XCG_FT_Fixed ftMiterLimit;
+
+	double scale = cg_matrix_stroke_scale(m);
+
+	ftWidth = (XCG_FT_Fixed)(stroke->width * scale * 0.5 * (1 << 6));
+	ftMiterLimit = (XCG_FT_Fixed)(stroke->miterlimit * (1 << 16));
+
+	switch(stroke->cap)
+	{
+	case CG_LINE_CAP_SQUARE:
+		ftCap = XCG_FT_STROKER_LINECAP_SQUARE;
+		break;
+	case CG_LINE_CAP_ROUND:
+		ftCap = XCG_FT_STROKER_LINECAP_ROUND;
+		break;
+	default:
+		ftCap = XCG_FT_STROKER_LINECAP_BUTT;
+		break;
+	}
+	switch(stroke->join)
+	{
+	case CG_LINE_JOIN_BEVEL:
+		ftJoin = XCG_FT_STROKER_LINEJOIN_BEVEL;
+		break;
+	case CG_LINE_JOIN_ROUND:
+		ftJoin = XCG_FT_STROKER_LINEJOIN_ROUND;
+		break;
+	default:
+		ftJoin = XCG_FT_STROKER_LINEJOIN_MITER_FIXED;
+		break;
+	}
+	XCG_FT_Stroker stroker;
+	XCG_FT_Stroker_New(&stroker);
+	XCG_FT_Stroker_Set(stroker, ftWidth, ftCap, ftJoin, ftMiterLimit);
+	XCG_FT_Stroker_ParseOutline(stroker, outline);
+
+	XCG_FT_UInt points;
+	XCG_FT_UInt contours;
+	XCG_FT_Stroker_GetCounts(stroker, &points, &contours);
+
+	ft_outline_init(outline, ctx, points, contours);
+	XCG_FT_Stroker_Export(stroker, outline);
+	XCG_FT_Stroker_Done(stroker);
+}
+
+static inline int cg_matrix_equal(struct cg_matrix_t * a, struct cg_matrix_t * b)
+{
+	return (a->a == b->a) && (a->b == b->b) && (a->c == b->c) && (a->d == b->d) && (a->tx == b->tx) && (a->ty == b->ty);
+}
+
+static inline int cg_stroke_data_equal(struct cg_stroke_data_t * a, struct cg_stroke_data_t * b)
+{
+	if((a->width != b->width) || (a->miterlimit != b->miterlimit) || (a->cap != b->cap) || (a->join != b->join))
+		return 0;
+	if(!a->dash || !b->dash)
+		return a->dash == b->dash;
+	if((a->dash->offset != b->dash->offset) || (a->dash->size != b->dash->size))
+		return 0;
+	return memcmp(a->dash->data, b->dash->data, (size_t)a->dash->size * sizeof(double)) == 0;
+}
+
+static void cg_outline_cache_destroy(struct cg_outline_cache_t * cache)
+{
+	if(cache)
+	{
+		cg_dash_destroy(cache->stroke.dash);
+		if(cache->data)
+			free(cache->data);
+		free(cache);
+	}
+}
+
+static inline int cg_outline_cache_match(struct cg_outline_cache_t * cache, struct cg_path_t * path, struct cg_matrix_t * m, struct cg_stroke_data_t * stroke)
+{
+	if(!cache || (cache->serial != path->serial) || !cg_matrix_equal(&cache->matrix, m))
+		return 0;
+	return !stroke || cg_stroke_data_equal(&cache->stroke, stroke);
+}
+
+static void cg_outline_cache_store(struct cg_outline_cache_t ** slot, struct cg_path_t * path, struct cg_matrix_t * m, struct cg_stroke_data_t * stroke, XCG_FT_Outline * outline)
+{
+	struct cg_outline_cache_t * cache = *slot;
+	if(!cache)
+	{
+		cache = *slot = malloc(sizeof(struct cg_outline_cache_t));
+		cache->stroke.dash = NULL;
+		cache->data = NULL;
+		cache->size = 0;
+	}
+	size_t size_a = ALIGN_SIZE(outline->n_points * sizeof(XCG_FT_Vector));
+	size_t size_b = ALIGN_SIZE(outline->n_points * sizeof(char));
+	size_t size_c = ALIGN_SIZE(outline->n_contours * sizeof(int));
+	size_t size_d = ALIGN_SIZE(outline->n_contours * sizeof(char));
+	size_t size_n = size_a + size_b + size_c + size_d;
+	if(size_n > cache->size)
+	{
+		cache->data = realloc(cache->data, size_n);
+		cache->size = size_n;
+	}
+	XCG_FT_Byte * data = cache->data;
+	cache->outline = *outline;
+	cache->outline.points = (XCG_FT_Vector *)(data);
+	cache->outline.tags = (char *)(data + size_a);
+	cache->outline.contours = (int *)(data + size_a + size_b);
+	cache->outline.contours_flag = (char *)(data + size_a + size_b + size_c);
+	memcpy(cache->outline.points, outline->points, (size_t)outline->n_points * sizeof(XCG_FT_Vector));
+	memcpy(cache->outline.tags, outline->tags, (size_t)outline->n_points * sizeof(char));
+	memcpy(cache->outline.contours, outline->contours, (size_t)outline->n_contours * sizeof(int));
+	memcpy(cache->outline.contours_flag, outline->contours_flag, (size_t)outline->n_contours * sizeof(char));
+	cache->serial = path->serial;
+	cache->matrix = *m;
+	cg_dash_destroy(cache->stroke.dash);
 	if(stroke)
 	{
-		XCG_FT_Outline outline;
-		if(stroke->dash == NULL)
-			ft_outline_convert(&outline, ctx, path, m);
-		else
-			ft_outline_convert_dash(&outline, ctx, path, m, stroke->dash);
-		XCG_FT_Stroker_LineCap ftCap;
-		XCG_FT_Stroker_LineJoin ftJoin;
-		XCG_FT_Fixed ftWidth;
-		XCG_FT_Fixed ftMiterLimit;
+		cache->stroke = *stroke;
+		cache->stroke.dash = cg_dash_clone(stroke->dash);
+	}
+	else
+	{
+		memset(&cache->stroke, 0, sizeof(struct cg_stroke_data_t));
+	}
+}
 
-		struct cg_point_t p1 = { 0, 0 };
-		struct cg_point_t p2 = { 1.41421356237309504880, 1.41421356237309504880 };
-		struct cg_point_t p3;
+/*
+ * The path bounds in device space, padded for strokes by how far joins and caps can reach past the points
+ */
+static void cg_path_extents(struct cg_path_t * path, struct cg_matrix_t * m, struct cg_stroke_data_t * stroke, struct cg_rect_t * extents)
+{
+	if(path->bounds.x1 > path->bounds.x2)
+	{
+		extents->x = 0;
+		extents->y = 0;
+		extents->w = 0;
+		extents->h = 0;
+		return;
+	}
 
-		cg_matrix_map_point(m, &p1, &p1);
-		cg_matrix_map_point(m, &p2, &p2);
+	struct cg_point_t p[4] = {
+		{ path->bounds.x1, path->bounds.y1 },
+		{ path->bounds.x2, path->bounds.y1 },
+		{ path->bounds.x2, path->bounds.y2 },
+		{ path->bounds.x1, path->bounds.y2 },
+	};
+	struct cg_point_t q;
+	double x1 = HUGE_VAL, y1 = HUGE_VAL;
+	double x2 = -HUGE_VAL, y2 = -HUGE_VAL;
+	for(int i = 0; i < 4; i++)
+	{
+		cg_matrix_map_point(m, &p[i], &q);
+		x1 = CG_MIN(x1, q.x);
+		y1 = CG_MIN(y1, q.y);
+		x2 = CG_MAX(x2, q.x);
+		y2 = CG_MAX(y2, q.y);
+	}
 
-		p3.x = p2.x - p1.x;
-		p3.y = p2.y - p1.y;
+	if(stroke)
+	{
+		double reach = 1.0;
+		if(stroke->join == CG_LINE_JOIN_MITER)
+			reach = CG_MAX(reach, stroke->miterlimit);
+		if(stroke->cap == CG_LINE_CAP_SQUARE)
+			reach = CG_MAX(reach, 1.41421356237309504880);
+		double pad = fabs(stroke->width) * 0.5 * reach * cg_matrix_stroke_scale(m);
+		x1 -= pad;
+		y1 -= pad;
+		x2 += pad;
+		y2 += pad;
+	}
 
-		double scale = sqrt(p3.x * p3.x + p3.y * p3.y) / 2.0;
+	extents->x = x1;
+	extents->y = y1;
+	extents->w = x2 - x1;
+	extents->h = y2 - y1;
+}
 
-		ftWidth = (XCG_FT_Fixed)(stroke->width * scale * 0.5 * (1 << 6));
-		ftMiterLimit = (XCG_FT_Fixed)(stroke->miterlimit * (1 << 16));
+/*
+ * Test the padded bounds against the clip, with a pixel to spare for antialiasing, before any conversion or stroking is done
+ */
+static inline int cg_path_visible(struct cg_path_t * path, struct cg_matrix_t * m, struct cg_rect_t * clip, struct cg_stroke_data_t * stroke)
+{
+	if(path->bounds.x1 > path->bounds.x2)
+		return 0;
+	if(!clip)
+		return 1;
 
-		switch(stroke->cap)
-		{
-		case CG_LINE_CAP_SQUARE:
-			ftCap = XCG_FT_STROKER_LINECAP_SQUARE;
-			break;
-		case CG_LINE_CAP_ROUND:
-			ftCap = XCG_FT_STROKER_LINECAP_ROUND;
-			break;
-		default:
-			ftCap = XCG_FT_STROKER_LINECAP_BUTT;
-			break;
-		}
-		switch(stroke->join)
-		{
-		case CG_LINE_JOIN_BEVEL:
-			ftJoin = XCG_FT_STROKER_LINEJOIN_BEVEL;
-			break;
-		case CG_LINE_JOIN_ROUND:
-			ftJoin = XCG_FT_STROKER_LINEJOIN_ROUND;
-			break;
-		default:
-			ftJoin = XCG_FT_STROKER_LINEJOIN_MITER_FIXED;
-			break;
-		}
-		XCG_FT_Stroker stroker;
-		XCG_FT_Stroker_New(&stroker);
-		XCG_FT_Stroker_Set(stroker, ftWidth, ftCap, ftJoin, ftMiterLimit);
-		XCG_FT_Stroker_ParseOutline(stroker, &outline);
+	struct cg_rect_t e;
+	cg_path_extents(path, m, stroke, &e);
+	if((e.x + e.w + 1.0 < clip->x) || (e.x - 1.0 > clip->x + clip->w))
+		return 0;
+	if((e.y + e.h + 1.0 < clip->y) || (e.y - 1.0 > clip->y + clip->h))
+		return 0;
+	return 1;
+}
 
-		XCG_FT_UInt points;
-		XCG_FT_UInt contours;
-		XCG_FT_Stroker_GetCounts(stroker, &points, &contours);
+/*
+ * Paths other than the current path are retained by the caller, so their converted (and stroked)
+ * outline is kept on the path and reused while the path, matrix and stroke parameters are unchanged.
+ */
+static void cg_path_outline(struct cg_ctx_t * ctx, struct cg_path_t * path, struct cg_matrix_t * m, struct cg_stroke_data_t * stroke, XCG_FT_Outline * outline)
+{
+	struct cg_outline_cache_t ** slot = NULL;
+	if(path != ctx->path)
+		slot = stroke ? &path->stroke : &path->fill;
+	if(slot && cg_outline_cache_match(*slot, path, m, stroke))
+	{
+		*outline = (*slot)->outline;
+	}
+	else
+	{
+		if(stroke)
+			ft_outline_stroke(outline, ctx, path, m, stroke);
+		else
+			ft_outline_convert(outline, ctx, path, m);
+		if(slot)
+			cg_outline_cache_store(slot, path, m, stroke, outline);
+	}
+}
 
-		ft_outline_init(&outline, ctx, points, contours);
-		XCG_FT_Stroker_Export(stroker, &outline);
-		XCG_FT_Stroker_Done(stroker);
+/*
+ * Half the width of a rounded rectangle, given its half extents and corner radii, at a distance dy from its centre
+ */
+static inline double shape_half_width(double hw, double hh, double rx, double ry, double dy)
+{
+	if(dy >= hh)
+		return 0;
+	double ey = dy - (hh - ry);
+	if(ey <= 0)
+		return hw;
+	double t = ey / ry;
+	return hw - rx + rx * sqrt(1 - t * t);
+}
 
-		outline.flags = XCG_FT_OUTLINE_NONE;
-		params.source = &outline;
-		XCG_FT_Raster_Render(&params);
+/*
+ * Coverage of the pixel centred at (px, py), relative to the shape centre. The edge is taken as the
+ * straight line at the first order signed distance d along the normal n, and the unit square is cut
+ * by it exactly: linear across the middle, a corner triangle t^2 / (2 * a * b) near either end.
+ */
+static inline int shape_coverage(double hw, double hh, double rx, double ry, double px, double py)
+{
+	double qx = fabs(px) - (hw - rx);
+	double qy = fabs(py) - (hh - ry);
+	double d, nx, ny;
+	if((qx > 0) && (qy > 0))
+	{
+		double f = (qx * qx) / (rx * rx) + (qy * qy) / (ry * ry) - 1;
+		double gx = qx / (rx * rx);
+		double gy = qy / (ry * ry);
+		double g = sqrt(gx * gx + gy * gy);
+		d = f / (2 * g);
+		nx = gx / g;
+		ny = gy / g;
+	}
+	else if(qx - rx > qy - ry)
+	{
+		d = qx - rx;
+		nx = 1;
+		ny = 0;
 	}
 	else
 	{
-		XCG_FT_Outline outline;
-		ft_outline_convert(&outline, ctx, path, m);
-		switch(winding)
+		d = qy - ry;
+		nx = 0;
+		ny = 1;
+	}
+	double a = CG_MAX(nx, ny);
+	double b = CG_MIN(nx, ny);
+	double e = fabs(d);
+	double c;
+	if(e <= (a - b) * 0.5)
+	{
+		c = 0.5 + e / a;
+	}
+	else if(e < (a + b) * 0.5)
+	{
+		double t = (a + b) * 0.5 - e;
+		c = 1 - t * t / (2 * a * b);
+	}
+	else
+	{
+		c = 1;
+	}
+	if(d > 0)
+		c = 1 - c;
+	return (int)(c * 255 + 0.5);
+}
+
+static inline void shape_span(struct cg_rle_t * rle, int x, int y, int len, int coverage)
+{
+	if((len <= 0) || (coverage <= 0))
+		return;
+	if(rle->spans.size > 0)
+	{
+		struct cg_span_t * last = &rle->spans.data[rle->spans.size - 1];
+		if((last->y == y) && (last->x + last->len == x) && (last->coverage == coverage))
 		{
-		case CG_FILL_RULE_EVEN_ODD:
-			outline.flags = XCG_FT_OUTLINE_EVEN_ODD_FILL;
-			break;
-		default:
-			outline.flags = XCG_FT_OUTLINE_NONE;
-			break;
+			last->len += len;
+			return;
 		}
+	}
+	cg_array_ensure(rle->spans, 1);
+	struct cg_span_t * span = &rle->spans.data[rle->spans.size++];
+	span->x = x;
+	span->len = len;
+	span->y = y;
+	span->coverage = coverage;
+}
 
-		params.source = &outline;
-		XCG_FT_Raster_Render(&params);
+static inline void shape_edge(struct cg_rle_t * rle, int x1, int x2, int y, int cx1, int cx2, double hw, double hh, double rx, double ry, double cx, double cy)
+{
+	x1 = CG_MAX(x1, cx1);
+	x2 = CG_MIN(x2, cx2);
+	for(int x = x1; x < x2; x++)
+		shape_span(rle, x, y, 1, shape_coverage(hw, hh, rx, ry, x + 0.5 - cx, y + 0.5 - cy));
+}
+
+/*
+ * Unrotated ellipses and rounded rectangles are covered analytically: per row the inner extent gives
+ * one full coverage span and only the pixels between the inner and outer extents get antialiased,
+ * from their distance to the edge. Corners curving tighter than a pixel are left to the rasterizer.
+ */
+static int cg_rle_rasterize_shape(struct cg_rle_t * rle, struct cg_path_t * path, struct cg_matrix_t * m, struct cg_rect_t * clip)
+{
+	double w = fabs(path->shape.w * m->a);
+	double h = fabs(path->shape.h * m->d);
+	double rx = fabs(path->shape.rx * m->a);
+	double ry = fabs(path->shape.ry * m->d);
+	if((rx * rx < ry) || (ry * ry < rx) || (rx < 1) || (ry < 1))
+		return 0;
+	double hw = w * 0.5;
+	double hh = h * 0.5;
+	double cx = (path->shape.x + path->shape.w * 0.5) * m->a + m->tx;
+	double cy = (path->shape.y + path->shape.h * 0.5) * m->d + m->ty;
+
+	int cx1 = INT_MIN, cy1 = INT_MIN;
+	int cx2 = INT_MAX, cy2 = INT_MAX;
+	if(clip)
+	{
+		cx1 = (int)(clip->x);
+		cy1 = (int)(clip->y);
+		cx2 = (int)(clip->x + clip->w);
+		cy2 = (int)(clip->y + clip->h);
 	}
+	double top = floor(cy - hh);
+	double bottom = ceil(cy + hh);
+	if((top >= cy2) || (bottom <= cy1) || (floor(cx - hw) >= cx2) || (ceil(cx + hw) <= cx1))
+		return 1;
+	int y1 = CG_MAX((int)top, cy1);
+	int y2 = CG_MIN((int)bottom, cy2);
+	for(int y = y1; y < y2; y++)
+	{
+		double dt = y - cy;
+		double db = y + 1 - cy;
+		double dn = ((dt <= 0) && (db >= 0)) ? 0 : CG_MIN(fabs(dt), fabs(db));
+		double ho = shape_half_width(hw, hh, rx, ry, dn);
+		double hi = CG_MIN(shape_half_width(hw, hh, rx, ry, fabs(dt)), shape_half_width(hw, hh, rx, ry, fabs(db)));
+		int xs = (int)floor(cx - ho);
+		int xe = (int)ceil(cx + ho);
+		int il = (int)ceil(cx - hi);
+		int ir = (int)floor(cx + hi);
+		if((hi <= 0) || (il >= ir))
+		{
+			shape_edge(rle, xs, xe, y, cx1, cx2, hw, hh, rx, ry, cx, cy);
+		}
+		else
+		{
+			shape_edge(rle, xs, il, y, cx1, cx2, hw, hh, rx, ry, cx, cy);
+			int x1 = CG_MAX(il, cx1);
+			int x2 = CG_MIN(ir, cx2);
+			shape_span(rle, x1, y, x2 - x1, 255);
+			shape_edge(rle, ir, xe, y, cx1, cx2, hw, hh, rx, ry, cx, cy);
+		}
+	}
+	return 1;
+}
 
-	if(rle->spans.size == 0)
+static void cg_rle_rasterize(struct cg_ctx_t * ctx, struct cg_rle_t * rle, struct cg_path_t * path, struct cg_matrix_t * m, struct cg_rect_t * clip, struct cg_stroke_data_t * stroke, enum cg_fill_rule_t winding)
+{
+	XCG_FT_Raster_Params params;
+	params.flags = XCG_FT_RASTER_FLAG_DIRECT | XCG_FT_RASTER_FLAG_AA;
+	params.gray_spans = generation_callback;
+	params.user = rle;
+	if(clip)
 	{
-		rle->x = 0;
-		rle->y = 0;
-		rle->w = 0;
-		rle->h = 0;
-		return;
+		params.flags |= XCG_FT_RASTER_FLAG_CLIP;
+		params.clip_box.xMin = (XCG_FT_Pos)(clip->x);
+		params.clip_box.yMin = (XCG_FT_Pos)(clip->y);
+		params.clip_box.xMax = (XCG_FT_Pos)(clip->x + clip->w);
+		params.clip_box.yMax = (XCG_FT_Pos)(clip->y + clip->h);
 	}
 
-	struct cg_span_t *spans = rle->spans.data;
-	int x1 = INT_MAX;
-	int y1 = spans[0].y;
-	int x2 = 0;
-	int y2 = spans[rle->spans.size - 1].y;
-	for(int i = 0; i < rle->spans.size; i++)
+	int done = 0;
+	if(!stroke && cg_path_is_shape(path) && (cg_matrix_get_type(m) <= CG_MATRIX_TYPE_SCALE))
+		done = cg_rle_rasterize_shape(rle, path, m, clip);
+	if(!done && cg_path_visible(path, m, clip, stroke))
 	{
-		if(spans[i].x < x1)
-			x1 = spans[i].x;
-		if(spans[i].x + spans[i].len > x2)
-			x2 = spans[i].x + spans[i].len;
+		XCG_FT_Outline outline;
+		cg_path_outline(ctx, path, m, stroke, &outline);
+		if(stroke)
+		{
+			outline.flags = XCG_FT_OUTLINE_NONE;
+		}
+		else
+		{
+			switch(winding)
+			{
+			case CG_FILL_RULE_EVEN_ODD:
+				outline.flags = XCG_FT_OUTLINE_EVEN_ODD_FILL;
+				break;
+			default:
+				outline.flags = XCG_FT_OUTLINE_NONE;
+				break;
+			}
+		}
+		params.source = &outline;
+		XCG_FT_Raster_Render(&params);
 	}
 
-	rle->x = x1;
-	rle->y = y1;
-	rle->w = x2 - x1;
-	rle->h = y2 - y1 + 1;
+	cg_rle_update_extents(rle);
 }
 
 static struct cg_rle_t * cg_rle_intersection(struct cg_rle_t * a, struct cg_rle_t * b)
@@ -1054,31 +1894,7 @@ static struct cg_rle_t * cg_rle_intersection(struct cg_rle_t * a, struct cg_rle_
 			++b_spans;
 		}
 	}
-	if(result->spans.size == 0)
-	{
-		result->x = 0;
-		result->y = 0;
-		result->w = 0;
-		result->h = 0;
-		return result;
-	}
-	struct cg_span_t * spans = result->spans.data;
-	int x1 = INT_MAX;
-	int y1 = spans[0].y;
-	int x2 = 0;
-	int y2 = spans[result->spans.size - 1].y;
-	for(int i = 0; i < result->spans.size; i++)
-	{
-		if(spans[i].x < x1)
-			x1 = spans[i].x;
-		if(spans[i].x + spans[i].len > x2)
-			x2 = spans[i].x + spans[i].len;
-	}
-	result->x = x1;
-	result->y = y1;
-	result->w = x2 - x1;
-	result->h = y2 - y1 + 1;
-
+	cg_rle_update_extents(result);
 	return result;
 }
 
@@ -1125,44 +1941,343 @@ static inline void cg_rle_clear(struct cg_rle_t * rle)
 	rle->h = 0;
 }
 
-static void cg_gradient_init_linear(struct cg_gradient_t * gradient, double x1, double y1, double x2, double y2)
+/*
+ * Appends the spans of source moved by whole pixels, cut to the clip rectangle
+ */
+static void cg_rle_append_translated(struct cg_rle_t * rle, struct cg_rle_t * source, int dx, int dy, struct cg_rect_t * clip)
 {
-	gradient->type = CG_GRADIENT_TYPE_LINEAR;
-	gradient->spread = CG_SPREAD_METHOD_PAD;
-	gradient->opacity = 1.0;
-	gradient->stops.size = 0;
-	cg_matrix_init_identity(&gradient->matrix);
-	cg_gradient_set_values_linear(gradient, x1, y1, x2, y2);
-}
+	int cx1 = (int)clip->x;
+	int cy1 = (int)clip->y;
+	int cx2 = (int)(clip->x + clip->w);
+	int cy2 = (int)(clip->y + clip->h);
 
-static void cg_gradient_init_radial(struct cg_gradient_t * gradient, double cx, double cy, double cr, double fx, double fy, double fr)
-{
-	gradient->type = CG_GRADIENT_TYPE_RADIAL;
-	gradient->spread = CG_SPREAD_METHOD_PAD;
-	gradient->opacity = 1.0;
-	gradient->stops.size = 0;
-	cg_matrix_init_identity(&gradient->matrix);
-	cg_gradient_set_values_radial(gradient, cx, cy, cr, fx, fy, fr);
+	cg_array_ensure(rle->spans, source->spans.size);
+	struct cg_span_t * spans = source->spans.data;
+	struct cg_span_t * end = spans + source->spans.size;
+	struct cg_span_t * data = rle->spans.data + rle->spans.size;
+	for(; spans < end; spans++)
+	{
+		int y = spans->y + dy;
+		if(y < cy1)
+			continue;
+		if(y >= cy2)
+			break;
+		int x1 = CG_MAX(spans->x + dx, cx1);
+		int x2 = CG_MIN(spans->x + spans->len + dx, cx2);
+		if(x1 < x2)
+		{
+			data->x = x1;
+			data->len = x2 - x1;
+			data->y = y;
+			data->coverage = spans->coverage;
+			data++;
+		}
+	}
+	rle->spans.size = data - rle->spans.data;
 }
 
-void cg_gradient_set_values_linear(struct cg_gradient_t * gradient, double x1, double y1, double x2, double y2)
+/*
+ * The mask cache is a hash table of entries chained per bucket, threaded on a most recently used
+ * list. It is only consulted while the budget is non zero, and paths whose extents exceed the clip
+ * are left to the rasterizer, as the entry would hold more than can ever be drawn.
+ */
+#define CG_MASK_BUCKETS		(1024)
+
+static inline uint64_t cg_mask_hash(uint64_t h, const void * data, size_t size)
 {
-	gradient->values[0] = x1;
-	gradient->values[1] = y1;
-	gradient->values[2] = x2;
-	gradient->values[3] = y2;
+	const unsigned char * p = data;
+	uint64_t w;
+	for(; size >= 8; size -= 8, p += 8)
+	{
+		memcpy(&w, p, 8);
+		h = (h ^ w) * 0x100000001b3ULL;
+		h ^= h >> 29;
+	}
+	for(; size > 0; size--, p++)
+		h = (h ^ *p) * 0x100000001b3ULL;
+	return h;
 }
 
-void cg_gradient_set_values_radial(struct cg_gradient_t * gradient, double cx, double cy, double cr, double fx, double fy, double fr)
+static uint64_t cg_mask_key(struct cg_path_t * path, struct cg_matrix_t * m, struct cg_stroke_data_t * stroke, enum cg_fill_rule_t winding)
 {
-	gradient->values[0] = cx;
-	gradient->values[1] = cy;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	double v[6] = { m->a, m->b, m->c, m->d, m->tx, m->ty };
+	h = cg_mask_hash(h, path->elements.data, (size_t)path->elements.size * sizeof(path->elements.data[0]));
+	h = cg_mask_hash(h, path->points.data, (size_t)path->points.size * sizeof(path->points.data[0]));
+	h = cg_mask_hash(h, v, sizeof(v));
+	if(stroke)
+	{
+		double w[2] = { stroke->width, stroke->miterlimit };
+		int k[2] = { stroke->cap, stroke->join };
+		h = cg_mask_hash(h, w, sizeof(w));
+		h = cg_mask_hash(h, k, sizeof(k));
+	}
+	else
+	{
+		h = cg_mask_hash(h, &winding, sizeof(winding));
+	}
+	return h;
+}
+
+static inline int cg_mask_match(struct cg_mask_t * mask, uint64_t hash, struct cg_path_t * path, struct cg_matrix_t * m, struct cg_stroke_data_t * stroke, enum cg_fill_rule_t winding)
+{
+	if((mask->hash != hash) || (mask->nelement != path->elements.size) || (mask->npoint != path->points.size))
+		return 0;
+	if((mask->stroked != (stroke != NULL)) || (mask->winding != winding) || !cg_matrix_equal(&mask->matrix, m))
+		return 0;
+	if(stroke && !cg_stroke_data_equal(&mask->stroke, stroke))
+		return 0;
+	/*
+	 * The hash only picks the candidate, a collision must cost a rebuild and not a wrong mask
+	 */
+	if(memcmp(mask->elements, path->elements.data, (size_t)path->elements.size * sizeof(cg_path_code_t)) != 0)
+		return 0;
+	return memcmp(mask->points, path->points.data, (size_t)path->points.size * sizeof(struct cg_path_point_t)) == 0;
+}
+
+static inline void cg_mask_unlink(struct cg_mask_cache_t * cache, struct cg_mask_t * mask)
+{
+	if(mask->prev)
+		mask->prev->next = mask->next;
+	else
+		cache->head = mask->next;
+	if(mask->next)
+		mask->next->prev = mask->prev;
+	else
+		cache->tail = mask->prev;
+}
+
+static inline void cg_mask_push(struct cg_mask_cache_t * cache, struct cg_mask_t * mask)
+{
+	mask->prev = NULL;
+	mask->next = cache->head;
+	if(cache->head)
+		cache->head->prev = mask;
+	else
+		cache->tail = mask;
+	cache->head = mask;
+}
+
+static void cg_mask_free(struct cg_mask_t * mask)
+{
+	free(mask->elements);
+	free(mask->points);
+	free(mask->rle.spans.data);
+	cg_dash_destroy(mask->stroke.dash);
+	free(mask);
+}
+
+static void cg_mask_evict(struct cg_mask_cache_t * cache, struct cg_mask_t * mask)
+{
+	struct cg_mask_t ** link = &cache->buckets[mask->hash & (CG_MASK_BUCKETS - 1)];
+	while(*link != mask)
+		link = &(*link)->chain;
+	*link = mask->chain;
+	cg_mask_unlink(cache, mask);
+	cache->size -= mask->size;
+	cg_mask_free(mask);
+}
+
+/*
+ * Produces the spans of a fill or stroke through the cache, returns zero when the path is not
+ * cacheable and has to be rasterized as usual
+ */
+static int cg_mask_cache_rasterize(struct cg_ctx_t * ctx, struct cg_rle_t * rle, struct cg_path_t * path, struct cg_matrix_t * m, struct cg_stroke_data_t * stroke, enum cg_fill_rule_t winding)
+{
+	struct cg_mask_cache_t * cache = &ctx->masks;
+	struct cg_rect_t * clip = &ctx->clip;
+	struct cg_matrix_t t;
+	struct cg_rect_t e, r;
+
+	if((cache->budget == 0) || (path->bounds.x1 > path->bounds.x2) || !isfinite(m->tx) || !isfinite(m->ty))
+		return 0;
+	double ix = floor(m->tx);
+	double iy = floor(m->ty);
+	t = *m;
+	t.tx -= ix;
+	t.ty -= iy;
+	t.type = CG_MATRIX_TYPE_UNKNOWN;
+	cg_path_extents(path, &t, stroke, &e);
+	if((e.w > clip->w) || (e.h > clip->h))
+		return 0;
+	if((e.x + ix >= clip->x + clip->w + 1) || (e.x + e.w + ix <= clip->x - 1) || (e.y + iy >= clip->y + clip->h + 1) || (e.y + e.h + iy <= clip->y - 1))
+		return 0;
+
+	if(stroke)
+		winding = CG_FILL_RULE_NON_ZERO;
+	uint64_t hash = cg_mask_key(path, &t, stroke, winding);
+	struct cg_mask_t ** bucket = &cache->buckets[hash & (CG_MASK_BUCKETS - 1)];
+	struct cg_mask_t * mask = *bucket;
+	while(mask && !cg_mask_match(mask, hash, path, &t, stroke, winding))
+		mask = mask->chain;
+	if(mask)
+	{
+		cache->hits++;
+		cg_mask_unlink(cache, mask);
+		cg_mask_push(cache, mask);
+		cg_rle_append_translated(rle, &mask->rle, (int)ix, (int)iy, clip);
+		cg_rle_update_extents(rle);
+		return 1;
+	}
+
+	mask = malloc(sizeof(struct cg_mask_t));
+	mask->hash = hash;
+	mask->nelement = path->elements.size;
+	mask->npoint = path->points.size;
+	mask->matrix = t;
+	mask->stroked = stroke != NULL;
+	mask->winding = winding;
+	if(stroke)
+	{
+		mask->stroke = *stroke;
+		mask->stroke.dash = cg_dash_clone(stroke->dash);
+	}
+	else
+	{
+		memset(&mask->stroke, 0, sizeof(struct cg_stroke_data_t));
+	}
+	cg_array_init(mask->rle.spans);
+	mask->elements = malloc((size_t)CG_MAX(path->elements.size, 1) * sizeof(cg_path_code_t));
+	mask->points = malloc((size_t)CG_MAX(path->points.size, 1) * sizeof(struct cg_path_point_t));
+	if(!mask->elements || !mask->points)
+	{
+		cg_mask_free(mask);
+		return 0;
+	}
+	cache->misses++;
+	memcpy(mask->elements, path->elements.data, (size_t)path->elements.size * sizeof(cg_path_code_t));
+	memcpy(mask->points, path->points.data, (size_t)path->points.size * sizeof(struct cg_path_point_t));
+	r.x = floor(e.x) - 1;
+	r.y = floor(e.y) - 1;
+	r.w = ceil(e.x + e.w) + 2 - r.x;
+	r.h = ceil(e.y + e.h) + 2 - r.y;
+	cg_rle_rasterize(ctx, &mask->rle, path, &t, &r, stroke, winding);
+	if(mask->rle.spans.size < mask->rle.spans.capacity)
+	{
+		mask->rle.spans.data = realloc(mask->rle.spans.data, (size_t)CG_MAX(mask->rle.spans.size, 1) * sizeof(struct cg_span_t));
+		mask->rle.spans.capacity = CG_MAX(mask->rle.spans.size, 1);
+	}
+	mask->size = sizeof(struct cg_mask_t) + (size_t)mask->rle.spans.capacity * sizeof(struct cg_span_t)
+		+ (size_t)mask->nelement * sizeof(cg_path_code_t) + (size_t)mask->npoint * sizeof(struct cg_path_point_t);
+	cg_rle_append_translated(rle, &mask->rle, (int)ix, (int)iy, clip);
+	cg_rle_update_extents(rle);
+
+	if(mask->size > cache->budget)
+	{
+		cg_mask_free(mask);
+		return 1;
+	}
+	while(cache->tail && (cache->size + mask->size > cache->budget))
+		cg_mask_evict(cache, cache->tail);
+	mask->chain = *bucket;
+	*bucket = mask;
+	cg_mask_push(cache, mask);
+	cache->size += mask->size;
+	return 1;
+}
+
+void cg_mask_cache_clear(struct cg_ctx_t * ctx)
+{
+	struct cg_mask_cache_t * cache = &ctx->masks;
+	while(cache->tail)
+		cg_mask_evict(cache, cache->tail);
+}
+
+/*
+ * A budget of zero turns the cache off and releases it, entries are dropped oldest first until
+ * the cache fits a smaller budget. The cache stays off if its buckets cannot be allocated
+ */
+void cg_mask_cache_set_budget(struct cg_ctx_t * ctx, size_t bytes)
+{
+	struct cg_mask_cache_t * cache = &ctx->masks;
+	cache->budget = bytes;
+	while(cache->tail && (cache->size > cache->budget))
+		cg_mask_evict(cache, cache->tail);
+	if(bytes == 0)
+	{
+		free(cache->buckets);
+		cache->buckets = NULL;
+	}
+	else if(!cache->buckets)
+	{
+		cache->buckets = calloc(CG_MASK_BUCKETS, sizeof(struct cg_mask_t *));
+		if(!cache->buckets)
+			cache->budget = 0;
+	}
+}
+
+void cg_mask_cache_stats(struct cg_ctx_t * ctx, unsigned long * hits, unsigned long * misses, size_t * size)
+{
+	if(hits)
+		*hits = ctx->masks.hits;
+	if(misses)
+		*misses = ctx->masks.misses;
+	if(size)
+		*size = ctx->masks.size;
+}
+
+static void cg_gradient_init_linear(struct cg_gradient_t * gradient, double x1, double y1, double x2, double y2)
+{
+	gradient->type = CG_GRADIENT_TYPE_LINEAR;
+	gradient->spread = CG_SPREAD_METHOD_PAD;
+	gradient->opacity = 1.0;
+	gradient->dither = 0;
+	gradient->stops.size = 0;
+	cg_matrix_init_identity(&gradient->matrix);
+	cg_gradient_set_values_linear(gradient, x1, y1, x2, y2);
+}
+
+static void cg_gradient_init_radial(struct cg_gradient_t * gradient, double cx, double cy, double cr, double fx, double fy, double fr)
+{
+	gradient->type = CG_GRADIENT_TYPE_RADIAL;
+	gradient->spread = CG_SPREAD_METHOD_PAD;
+	gradient->opacity = 1.0;
+	gradient->dither = 0;
+	gradient->stops.size = 0;
+	cg_matrix_init_identity(&gradient->matrix);
+	cg_gradient_set_values_radial(gradient, cx, cy, cr, fx, fy, fr);
+}
+
+static void cg_gradient_init_conic(struct cg_gradient_t * gradient, double cx, double cy, double angle)
+{
+	gradient->type = CG_GRADIENT_TYPE_CONIC;
+	gradient->spread = CG_SPREAD_METHOD_PAD;
+	gradient->opacity = 1.0;
+	gradient->dither = 0;
+	gradient->stops.size = 0;
+	cg_matrix_init_identity(&gradient->matrix);
+	cg_gradient_set_values_conic(gradient, cx, cy, angle);
+}
+
+void cg_gradient_set_values_linear(struct cg_gradient_t * gradient, double x1, double y1, double x2, double y2)
+{
+	gradient->values[0] = x1;
+	gradient->values[1] = y1;
+	gradient->values[2] = x2;
+	gradient->values[3] = y2;
+}
+
+void cg_gradient_set_values_radial(struct cg_gradient_t * gradient, double cx, double cy, double cr, double fx, double fy, double fr)
+{
+	gradient->values[0] = cx;
+	gradient->values[1] = cy;
 	gradient->values[2] = cr;
 	gradient->values[3] = fx;
 	gradient->values[4] = fy;
 	gradient->values[5] = fr;
 }
 
+/*
+ * Offset 0 lies at the given angle from the x axis and the stops run once around the centre
+ * in the direction of increasing angle, so the spread method makes no difference
+ */
+void cg_gradient_set_values_conic(struct cg_gradient_t * gradient, double cx, double cy, double angle)
+{
+	gradient->values[0] = cx;
+	gradient->values[1] = cy;
+	gradient->values[2] = angle;
+}
+
 void cg_gradient_set_spread(struct cg_gradient_t * gradient, enum cg_spread_method_t spread)
 {
 	gradient->spread = spread;
@@ -1171,6 +2286,7 @@ void cg_gradient_set_spread(struct cg_gradient_t * gradient, enum cg_spread_meth
 void cg_gradient_set_matrix(struct cg_gradient_t * gradient, struct cg_matrix_t * m)
 {
 	memcpy(&gradient->matrix, m, sizeof(struct cg_matrix_t));
+	gradient->matrix.type = CG_MATRIX_TYPE_UNKNOWN;
 }
 
 void cg_gradient_set_opacity(struct cg_gradient_t * gradient, double opacity)
@@ -1178,6 +2294,15 @@ void cg_gradient_set_opacity(struct cg_gradient_t * gradient, double opacity)
 	gradient->opacity = CG_CLAMP(opacity, 0.0, 1.0);
 }
 
+/*
+ * Dithered gradients keep the sub level part of every colour and spread it with a 4x4 ordered
+ * pattern, which hides the banding of long, low contrast gradients
+ */
+void cg_gradient_set_dither(struct cg_gradient_t * gradient, int dither)
+{
+	gradient->dither = dither ? 1 : 0;
+}
+
 void cg_gradient_add_stop_rgb(struct cg_gradient_t * gradient, double offset, double r, double g, double b)
 {
 	cg_gradient_add_stop_rgba(gradient, offset, r, g, b, 1.0);
@@ -1228,6 +2353,7 @@ static void cg_gradient_copy(struct cg_gradient_t * gradient, struct cg_gradient
 	gradient->spread = source->spread;
 	gradient->matrix = source->matrix;
 	gradient->opacity = source->opacity;
+	gradient->dither = source->dither;
 	cg_array_ensure(gradient->stops, source->stops.size);
 	memcpy(gradient->values, source->values, sizeof(source->values));
 	memcpy(gradient->stops.data, source->stops.data, source->stops.size * sizeof(struct cg_gradient_stop_t));
@@ -1244,6 +2370,7 @@ static void cg_texture_init(struct cg_texture_t * texture, struct cg_surface_t *
 	surface = cg_surface_reference(surface);
 	cg_surface_destroy(texture->surface);
 	texture->type = type;
+	texture->filter = CG_TEXTURE_FILTER_NEAREST;
 	texture->surface = surface;
 	texture->opacity = 1.0;
 	cg_matrix_init_identity(&texture->matrix);
@@ -1254,9 +2381,15 @@ void cg_texture_set_type(struct cg_texture_t * texture, enum cg_texture_type_t t
 	texture->type = type;
 }
 
+void cg_texture_set_filter(struct cg_texture_t * texture, enum cg_texture_filter_t filter)
+{
+	texture->filter = filter;
+}
+
 void cg_texture_set_matrix(struct cg_texture_t * texture, struct cg_matrix_t * m)
 {
 	memcpy(&texture->matrix, m, sizeof(struct cg_matrix_t));
+	texture->matrix.type = CG_MATRIX_TYPE_UNKNOWN;
 }
 
 void cg_texture_set_surface(struct cg_texture_t * texture, struct cg_surface_t * surface)
@@ -1276,6 +2409,7 @@ static void cg_texture_copy(struct cg_texture_t * texture, struct cg_texture_t *
 	struct cg_surface_t * surface = cg_surface_reference(source->surface);
 	cg_surface_destroy(texture->surface);
 	texture->type = source->type;
+	texture->filter = source->filter;
 	texture->surface = surface;
 	texture->opacity = source->opacity;
 	texture->matrix = source->matrix;
@@ -1319,10 +2453,15 @@ static void cg_paint_copy(struct cg_paint_t * paint, struct cg_paint_t * source)
 	}
 }
 
+#define CG_GRADIENT_TABLE_MIN	(256)
+#define CG_GRADIENT_TABLE_MAX	(4096)
+
 struct cg_gradient_data_t {
 	enum cg_spread_method_t spread;
 	struct cg_matrix_t matrix;
-	uint32_t colortable[1024];
+	int size;
+	uint32_t * colortable;
+	uint16_t * fractions;
 	union {
 		struct {
 			double x1, y1;
@@ -1332,6 +2471,10 @@ struct cg_gradient_data_t {
 			double cx, cy, cr;
 			double fx, fy, fr;
 		} radial;
+		struct {
+			double cx, cy;
+			double angle;
+		} conic;
 	};
 };
 
@@ -1341,6 +2484,7 @@ struct cg_texture_data_t {
 	int height;
 	int stride;
 	int alpha;
+	int filter;
 	void * pixels;
 };
 
@@ -1349,6 +2493,7 @@ struct cg_linear_gradient_values_t {
 	double dy;
 	double l;
 	double off;
+	void (*fetch)(uint32_t * dst, int len, const uint32_t * colortable, int size, int t, int inc);
 };
 
 struct cg_radial_gradient_values_t {
@@ -1358,9 +2503,57 @@ struct cg_radial_gradient_values_t {
 	double sqrfr;
 	double a;
 	double inv2a;
+	double reach;
 	int extended;
 };
 
+struct cg_fused_linear_t {
+	const uint32_t * colortable;
+	int size;
+	int t;
+	int inc;
+};
+
+struct cg_fused_radial_t {
+	struct cg_gradient_data_t * gradient;
+	double det;
+	double delta_det;
+	double delta_delta_det;
+	double b;
+	double delta_b;
+	double dr;
+	int x;
+	int y;
+};
+
+struct cg_fused_index_t {
+	const uint32_t * colortable;
+	const int * index;
+};
+
+struct cg_fused_dither_t {
+	const uint32_t * colortable;
+	const uint16_t * fractions;
+	const int * index;
+	const uint8_t * row;
+	int x;
+};
+
+struct cg_fused_clear_t {
+	int unused;
+};
+
+struct cg_fused_texture_t {
+	void * pixels;
+	int stride;
+	int width;
+	int height;
+	int x;
+	int y;
+	int fdx;
+	int fdy;
+};
+
 static inline uint32_t premultiply_color(struct cg_color_t * color, double opacity)
 {
 	uint32_t alpha = (uint8_t)(color->a * opacity * 255);
@@ -1403,6 +2596,23 @@ static inline uint32_t interpolate_pixel(uint32_t x, uint32_t a, uint32_t y, uin
 	return x;
 }
 
+/*
+ * Blends four premultiplied texels with weights out of 256, red and blue and then alpha and green
+ * packed two channels to a word, horizontally and then vertically
+ */
+static inline uint32_t bilinear_pixel(uint32_t tl, uint32_t tr, uint32_t bl, uint32_t br, uint32_t fx, uint32_t fy)
+{
+	uint32_t ifx = 256 - fx;
+	uint32_t ify = 256 - fy;
+	uint32_t trb = (((tl & 0xff00ff) * ifx + (tr & 0xff00ff) * fx) >> 8) & 0xff00ff;
+	uint32_t brb = (((bl & 0xff00ff) * ifx + (br & 0xff00ff) * fx) >> 8) & 0xff00ff;
+	uint32_t tag = ((((tl >> 8) & 0xff00ff) * ifx + ((tr >> 8) & 0xff00ff) * fx) >> 8) & 0xff00ff;
+	uint32_t bag = ((((bl >> 8) & 0xff00ff) * ifx + ((br >> 8) & 0xff00ff) * fx) >> 8) & 0xff00ff;
+	uint32_t rb = ((trb * ify + brb * fy) >> 8) & 0xff00ff;
+	uint32_t ag = (tag * ify + bag * fy) & 0xff00ff00;
+	return ag | rb;
+}
+
 static void __cg_memfill32(uint32_t * dst, uint32_t val, int len)
 {
 	for(int i = 0; i < len; i++)
@@ -1417,17 +2627,17 @@ static inline int gradient_clamp(struct cg_gradient_data_t * gradient, int ipos)
 	case CG_SPREAD_METHOD_PAD:
 		if(ipos < 0)
 			ipos = 0;
-		else if(ipos >= 1024)
-			ipos = 1024 - 1;
+		else if(ipos >= gradient->size)
+			ipos = gradient->size - 1;
 		break;
 	case CG_SPREAD_METHOD_REFLECT:
-		ipos = ipos % 2048;
-		ipos = ipos < 0 ? 2048 + ipos : ipos;
-		ipos = ipos >= 1024 ? 2048 - 1 - ipos : ipos;
+		ipos = ipos % (2 * gradient->size);
+		ipos = ipos < 0 ? 2 * gradient->size + ipos : ipos;
+		ipos = ipos >= gradient->size ? 2 * gradient->size - 1 - ipos : ipos;
 		break;
 	case CG_SPREAD_METHOD_REPEAT:
-		ipos = ipos % 1024;
-		ipos = ipos < 0 ? 1024 + ipos : ipos;
+		ipos = ipos % gradient->size;
+		ipos = ipos < 0 ? gradient->size + ipos : ipos;
 		break;
 	default:
 		break;
@@ -1444,30 +2654,120 @@ static inline uint32_t gradient_pixel_fixed(struct cg_gradient_data_t * gradient
 	return gradient->colortable[gradient_clamp(gradient, ipos)];
 }
 
+static inline int gradient_index(struct cg_gradient_data_t * gradient, double pos)
+{
+	return gradient_clamp(gradient, (int)floor(pos * gradient->size));
+}
+
 static inline uint32_t gradient_pixel(struct cg_gradient_data_t * gradient, double pos)
 {
-	int ipos = (int)(pos * (1024 - 1) + 0.5);
-	return gradient->colortable[gradient_clamp(gradient, ipos)];
+	return gradient->colortable[gradient_index(gradient, pos)];
 }
 
-static inline void fetch_linear_gradient(uint32_t * buffer, struct cg_linear_gradient_values_t * v, struct cg_gradient_data_t * gradient, int y, int x, int length)
+static const uint8_t cg_dither_matrix[4][4] = {
+	{  0,  8,  2, 10 },
+	{ 12,  4, 14,  6 },
+	{  3, 11,  1,  9 },
+	{ 15,  7, 13,  5 },
+};
+
+/*
+ * Each channel of a dithered table entry is rounded down and keeps four bits of its remainder,
+ * a channel is raised by one level where the remainder beats the threshold of the pattern
+ */
+static inline uint32_t dither_color(uint32_t color, uint32_t fraction, uint32_t threshold)
 {
-	double t, inc;
-	double rx = 0, ry = 0;
+	uint32_t a = CG_ALPHA(color) + (((fraction >> 12) & 0xf) > threshold);
+	uint32_t r = ((color >> 16) & 0xff) + (((fraction >> 8) & 0xf) > threshold);
+	uint32_t g = ((color >> 8) & 0xff) + (((fraction >> 4) & 0xf) > threshold);
+	uint32_t b = (color & 0xff) + ((fraction & 0xf) > threshold);
+	return (a << 24) | (CG_MIN(r, a) << 16) | (CG_MIN(g, a) << 8) | CG_MIN(b, a);
+}
+
+static inline uint32_t gradient_color(struct cg_gradient_data_t * gradient, int ipos, int x, int y)
+{
+	if(gradient->fractions)
+		return dither_color(gradient->colortable[ipos], gradient->fractions[ipos], cg_dither_matrix[y & 3][x & 3]);
+	return gradient->colortable[ipos];
+}
+
+/*
+ * Linear gradient kernels, one per spread method, walk a fixed point table position (FIXPT_BITS of
+ * fraction) by a constant step. They are branch free in the loop and can be replaced per platform.
+ */
+static void __cg_fetch_linear_pad(uint32_t * dst, int len, const uint32_t * colortable, int size, int t, int inc)
+{
+	for(int i = 0; i < len; i++)
+	{
+		int ipos = (t + (FIXPT_SIZE / 2)) >> FIXPT_BITS;
+		ipos = CG_CLAMP(ipos, 0, size - 1);
+		dst[i] = colortable[ipos];
+		t += inc;
+	}
+}
+extern __typeof(__cg_fetch_linear_pad) cg_fetch_linear_pad __attribute__((weak, alias("__cg_fetch_linear_pad")));
+
+static void __cg_fetch_linear_reflect(uint32_t * dst, int len, const uint32_t * colortable, int size, int t, int inc)
+{
+	for(int i = 0; i < len; i++)
+	{
+		int ipos = (t + (FIXPT_SIZE / 2)) >> FIXPT_BITS;
+		ipos = (ipos ^ -((ipos & size) != 0)) & (size - 1);
+		dst[i] = colortable[ipos];
+		t += inc;
+	}
+}
+extern __typeof(__cg_fetch_linear_reflect) cg_fetch_linear_reflect __attribute__((weak, alias("__cg_fetch_linear_reflect")));
+
+static void __cg_fetch_linear_repeat(uint32_t * dst, int len, const uint32_t * colortable, int size, int t, int inc)
+{
+	for(int i = 0; i < len; i++)
+	{
+		int ipos = (t + (FIXPT_SIZE / 2)) >> FIXPT_BITS;
+		dst[i] = colortable[ipos & (size - 1)];
+		t += inc;
+	}
+}
+extern __typeof(__cg_fetch_linear_repeat) cg_fetch_linear_repeat __attribute__((weak, alias("__cg_fetch_linear_repeat")));
+
+typedef void (*cg_fetch_linear_function_t)(uint32_t * dst, int len, const uint32_t * colortable, int size, int t, int inc);
+static const cg_fetch_linear_function_t cg_fetch_linear_map[] = {
+	cg_fetch_linear_pad,
+	cg_fetch_linear_reflect,
+	cg_fetch_linear_repeat,
+};
 
+static const cg_fetch_linear_function_t cg_fetch_linear_portable_map[] = {
+	__cg_fetch_linear_pad,
+	__cg_fetch_linear_reflect,
+	__cg_fetch_linear_repeat,
+};
+
+static inline void linear_gradient_position(struct cg_linear_gradient_values_t * v, struct cg_gradient_data_t * gradient, int y, int x, double * t, double * inc)
+{
 	if(v->l == 0.0)
 	{
-		t = inc = 0;
+		*t = *inc = 0;
 	}
 	else
 	{
-		rx = gradient->matrix.c * (y + 0.5) + gradient->matrix.a * (x + 0.5) + gradient->matrix.tx;
-		ry = gradient->matrix.d * (y + 0.5) + gradient->matrix.b * (x + 0.5) + gradient->matrix.ty;
-		t = v->dx * rx + v->dy * ry + v->off;
-		inc = v->dx * gradient->matrix.a + v->dy * gradient->matrix.b;
-		t *= (1024 - 1);
-		inc *= (1024 - 1);
+		double rx = gradient->matrix.c * (y + 0.5) + gradient->matrix.a * (x + 0.5) + gradient->matrix.tx;
+		double ry = gradient->matrix.d * (y + 0.5) + gradient->matrix.b * (x + 0.5) + gradient->matrix.ty;
+		*t = (v->dx * rx + v->dy * ry + v->off) * gradient->size - 0.5;
+		*inc = (v->dx * gradient->matrix.a + v->dy * gradient->matrix.b) * gradient->size;
 	}
+}
+
+static inline int linear_gradient_fixed(double t, double inc, int length)
+{
+	return (t + inc * length < (double)(INT_MAX >> (FIXPT_BITS + 1))) && (t + inc * length > (double)(INT_MIN >> (FIXPT_BITS + 1)));
+}
+
+static inline void fetch_linear_gradient(uint32_t * buffer, struct cg_linear_gradient_values_t * v, struct cg_gradient_data_t * gradient, int y, int x, int length)
+{
+	double t, inc;
+
+	linear_gradient_position(v, gradient, y, x, &t, &inc);
 	uint32_t * end = buffer + length;
 	if((inc > -1e-5) && (inc < 1e-5))
 	{
@@ -1475,22 +2775,15 @@ static inline void fetch_linear_gradient(uint32_t * buffer, struct cg_linear_gra
 	}
 	else
 	{
-		if(t + inc * length < (double)(INT_MAX >> (FIXPT_BITS + 1)) && t + inc * length > (double)(INT_MIN >> (FIXPT_BITS + 1)))
+		if(linear_gradient_fixed(t, inc, length))
 		{
-			int t_fixed = (int)(t * FIXPT_SIZE);
-			int inc_fixed = (int)(inc * FIXPT_SIZE);
-			while(buffer < end)
-			{
-				*buffer = gradient_pixel_fixed(gradient, t_fixed);
-				t_fixed += inc_fixed;
-				++buffer;
-			}
+			v->fetch(buffer, length, gradient->colortable, gradient->size, (int)(t * FIXPT_SIZE), (int)(inc * FIXPT_SIZE));
 		}
 		else
 		{
 			while(buffer < end)
 			{
-				*buffer = gradient_pixel(gradient, t / 1024);
+				*buffer = gradient_pixel(gradient, (t + 0.5) / gradient->size);
 				t += inc;
 				++buffer;
 			}
@@ -1498,81 +2791,6 @@ static inline void fetch_linear_gradient(uint32_t * buffer, struct cg_linear_gra
 	}
 }
 
-static inline void fetch_radial_gradient(uint32_t * buffer, struct cg_radial_gradient_values_t * v, struct cg_gradient_data_t * gradient, int y, int x, int length)
-{
-	if(v->a == 0.0)
-	{
-		cg_memfill32(buffer, 0, length);
-		return;
-	}
-
-	double rx = gradient->matrix.c * (y + 0.5) + gradient->matrix.tx + gradient->matrix.a * (x + 0.5);
-	double ry = gradient->matrix.d * (y + 0.5) + gradient->matrix.ty + gradient->matrix.b * (x + 0.5);
-	rx -= gradient->radial.fx;
-	ry -= gradient->radial.fy;
-
-	double inv_a = 1.0 / (2.0 * v->a);
-	double delta_rx = gradient->matrix.a;
-	double delta_ry = gradient->matrix.b;
-
-	double b = 2 * (v->dr * gradient->radial.fr + rx * v->dx + ry * v->dy);
-	double delta_b = 2 * (delta_rx * v->dx + delta_ry * v->dy);
-	double b_delta_b = 2 * b * delta_b;
-	double delta_b_delta_b = 2 * delta_b * delta_b;
-
-	double bb = b * b;
-	double delta_bb = delta_b * delta_b;
-
-	b *= inv_a;
-	delta_b *= inv_a;
-
-	double rxrxryry = rx * rx + ry * ry;
-	double delta_rxrxryry = delta_rx * delta_rx + delta_ry * delta_ry;
-	double rx_plus_ry = 2 * (rx * delta_rx + ry * delta_ry);
-	double delta_rx_plus_ry = 2 * delta_rxrxryry;
-
-	inv_a *= inv_a;
-
-	double det = (bb - 4 * v->a * (v->sqrfr - rxrxryry)) * inv_a;
-	double delta_det = (b_delta_b + delta_bb + 4 * v->a * (rx_plus_ry + delta_rxrxryry)) * inv_a;
-	double delta_delta_det = (delta_b_delta_b + 4 * v->a * delta_rx_plus_ry) * inv_a;
-
-	uint32_t * end = buffer + length;
-	if(v->extended)
-	{
-		while(buffer < end)
-		{
-			uint32_t result = 0;
-			det = fabs(det) < DBL_EPSILON ? 0.0 : det;
-			if(det >= 0)
-			{
-				double w = sqrt(det) - b;
-				if(gradient->radial.fr + v->dr * w >= 0)
-					result = gradient_pixel(gradient, w);
-			}
-			*buffer = result;
-			det += delta_det;
-			delta_det += delta_delta_det;
-			b += delta_b;
-			++buffer;
-		}
-	}
-	else
-	{
-		while(buffer < end)
-		{
-			det = fabs(det) < DBL_EPSILON ? 0.0 : det;
-			uint32_t result = 0;
-			if(det >= 0)
-				result = gradient_pixel(gradient, sqrt(det) - b);
-			*buffer++ = result;
-			det += delta_det;
-			delta_det += delta_delta_det;
-			b += delta_b;
-		}
-	}
-}
-
 static void __cg_comp_solid_source(uint32_t * dst, int len, uint32_t color, uint32_t alpha)
 {
 	if(alpha == 255)
@@ -1726,17 +2944,522 @@ static const cg_comp_function_t cg_comp_map[] = {
 	cg_comp_destination_out,
 };
 
-static inline void blend_solid(struct cg_surface_t * surface, enum cg_operator_t op, struct cg_rle_t * rle, uint32_t solid)
-{
-	cg_comp_solid_function_t func = cg_comp_solid_map[op];
-	int count = rle->spans.size;
-	struct cg_span_t * spans = rle->spans.data;
-	while(count--)
-	{
-		uint32_t * target = (uint32_t *)(surface->pixels + spans->y * surface->stride) + spans->x;
-		func(target, spans->len, solid, spans->coverage);
-		++spans;
-	}
+/*
+ * Fused kernels fetch each source pixel and composite it in place, instead of filling a scratch
+ * buffer for a cg_comp_* call. CG_FUSED_KERNELS(name, type, fetch) defines name##_map, one kernel
+ * per operator followed by one that only stores the pixels. The kernels walk a local copy of the
+ * state, fetch(st, &s) puts the next source pixel in s and advances st, returning zero for a pixel
+ * that is to be left untouched. They are only used while the cg_comp_* kernels are the portable
+ * ones, so platform kernels keep working.
+ */
+#define CG_FUSED_STORE		(4)
+
+#define CG_FUSED_KERNELS(name, type, fetch) \
+static void name##_source(uint32_t * dst, int len, const type * st, uint32_t alpha) \
+{ \
+	type state = *st; \
+	uint32_t s; \
+	if(alpha == 255) \
+	{ \
+		for(int i = 0; i < len; i++) \
+		{ \
+			if(fetch(&state, &s)) \
+				dst[i] = s; \
+		} \
+	} \
+	else \
+	{ \
+		uint32_t ialpha = 255 - alpha; \
+		for(int i = 0; i < len; i++) \
+		{ \
+			if(fetch(&state, &s)) \
+				dst[i] = interpolate_pixel(s, alpha, dst[i], ialpha); \
+		} \
+	} \
+} \
+static void name##_source_over(uint32_t * dst, int len, const type * st, uint32_t alpha) \
+{ \
+	type state = *st; \
+	uint32_t s; \
+	if(alpha == 255) \
+	{ \
+		for(int i = 0; i < len; i++) \
+		{ \
+			if(fetch(&state, &s)) \
+			{ \
+				if(s >= 0xff000000) \
+					dst[i] = s; \
+				else if(s != 0) \
+					dst[i] = s + CG_BYTE_MUL(dst[i], CG_ALPHA(~s)); \
+			} \
+		} \
+	} \
+	else \
+	{ \
+		for(int i = 0; i < len; i++) \
+		{ \
+			if(fetch(&state, &s)) \
+			{ \
+				s = CG_BYTE_MUL(s, alpha); \
+				dst[i] = s + CG_BYTE_MUL(dst[i], CG_ALPHA(~s)); \
+			} \
+		} \
+	} \
+} \
+static void name##_destination_in(uint32_t * dst, int len, const type * st, uint32_t alpha) \
+{ \
+	type state = *st; \
+	uint32_t s; \
+	if(alpha == 255) \
+	{ \
+		for(int i = 0; i < len; i++) \
+		{ \
+			if(fetch(&state, &s)) \
+				dst[i] = CG_BYTE_MUL(dst[i], CG_ALPHA(s)); \
+		} \
+	} \
+	else \
+	{ \
+		uint32_t cia = 255 - alpha; \
+		for(int i = 0; i < len; i++) \
+		{ \
+			if(fetch(&state, &s)) \
+				dst[i] = CG_BYTE_MUL(dst[i], CG_BYTE_MUL(CG_ALPHA(s), alpha) + cia); \
+		} \
+	} \
+} \
+static void name##_destination_out(uint32_t * dst, int len, const type * st, uint32_t alpha) \
+{ \
+	type state = *st; \
+	uint32_t s; \
+	if(alpha == 255) \
+	{ \
+		for(int i = 0; i < len; i++) \
+		{ \
+			if(fetch(&state, &s)) \
+				dst[i] = CG_BYTE_MUL(dst[i], CG_ALPHA(~s)); \
+		} \
+	} \
+	else \
+	{ \
+		uint32_t cia = 255 - alpha; \
+		for(int i = 0; i < len; i++) \
+		{ \
+			if(fetch(&state, &s)) \
+				dst[i] = CG_BYTE_MUL(dst[i], CG_BYTE_MUL(CG_ALPHA(~s), alpha) + cia); \
+		} \
+	} \
+} \
+static void name##_store(uint32_t * dst, int len, const type * st, uint32_t alpha) \
+{ \
+	type state = *st; \
+	uint32_t s; \
+	(void)alpha; \
+	for(int i = 0; i < len; i++) \
+	{ \
+		if(fetch(&state, &s)) \
+			dst[i] = s; \
+	} \
+} \
+static void (* const name##_map[])(uint32_t * dst, int len, const type * st, uint32_t alpha) = { \
+	name##_source, \
+	name##_source_over, \
+	name##_destination_in, \
+	name##_destination_out, \
+	name##_store, \
+};
+
+static const cg_comp_function_t cg_comp_portable_map[] = {
+	__cg_comp_source,
+	__cg_comp_source_over,
+	__cg_comp_destination_in,
+	__cg_comp_destination_out,
+};
+
+static inline int cg_fused_enabled(enum cg_operator_t op)
+{
+	return cg_comp_map[op] == cg_comp_portable_map[op];
+}
+
+static inline int linear_pad_pixel(struct cg_fused_linear_t * st, uint32_t * s)
+{
+	int ipos = (st->t + (FIXPT_SIZE / 2)) >> FIXPT_BITS;
+	*s = st->colortable[CG_CLAMP(ipos, 0, st->size - 1)];
+	st->t += st->inc;
+	return 1;
+}
+
+static inline int linear_reflect_pixel(struct cg_fused_linear_t * st, uint32_t * s)
+{
+	int ipos = (st->t + (FIXPT_SIZE / 2)) >> FIXPT_BITS;
+	*s = st->colortable[(ipos ^ -((ipos & st->size) != 0)) & (st->size - 1)];
+	st->t += st->inc;
+	return 1;
+}
+
+static inline int linear_repeat_pixel(struct cg_fused_linear_t * st, uint32_t * s)
+{
+	int ipos = (st->t + (FIXPT_SIZE / 2)) >> FIXPT_BITS;
+	*s = st->colortable[ipos & (st->size - 1)];
+	st->t += st->inc;
+	return 1;
+}
+
+/*
+ * Without a focal radius and with the focal point inside the end circle the discriminant cannot
+ * be negative, so a negative value is rounding and every pixel gets a colour
+ */
+static inline int radial_pixel(struct cg_fused_radial_t * st, uint32_t * s)
+{
+	double det = st->det < DBL_EPSILON ? 0.0 : st->det;
+	*s = gradient_color(st->gradient, gradient_index(st->gradient, sqrt(det) - st->b), st->x, st->y);
+	st->x++;
+	st->det = det + st->delta_det;
+	st->delta_det += st->delta_delta_det;
+	st->b += st->delta_b;
+	return 1;
+}
+
+static inline int radial_extended_pixel(struct cg_fused_radial_t * st, uint32_t * s)
+{
+	double det = fabs(st->det) < DBL_EPSILON ? 0.0 : st->det;
+	*s = 0;
+	if(det >= 0)
+	{
+		double w = sqrt(det) - st->b;
+		if(st->gradient->radial.fr + st->dr * w >= 0)
+			*s = gradient_color(st->gradient, gradient_index(st->gradient, w), st->x, st->y);
+	}
+	st->x++;
+	st->det = det + st->delta_det;
+	st->delta_det += st->delta_delta_det;
+	st->b += st->delta_b;
+	return 1;
+}
+
+static inline int index_pixel(struct cg_fused_index_t * st, uint32_t * s)
+{
+	*s = st->colortable[*st->index++];
+	return 1;
+}
+
+static inline int index_dither_pixel(struct cg_fused_dither_t * st, uint32_t * s)
+{
+	int ipos = *st->index++;
+	*s = dither_color(st->colortable[ipos], st->fractions[ipos], st->row[st->x++ & 3]);
+	return 1;
+}
+
+static inline int clear_pixel(struct cg_fused_clear_t * st, uint32_t * s)
+{
+	(void)st;
+	*s = 0;
+	return 1;
+}
+
+static inline int texture_pixel(struct cg_fused_texture_t * st, uint32_t * s)
+{
+	int px = st->x >> 16;
+	int py = st->y >> 16;
+	st->x += st->fdx;
+	st->y += st->fdy;
+	if(((unsigned int)px < (unsigned int)st->width) && ((unsigned int)py < (unsigned int)st->height))
+	{
+		*s = ((uint32_t *)(st->pixels + py * st->stride))[px];
+		return 1;
+	}
+	return 0;
+}
+
+static inline int texture_tiled_pixel(struct cg_fused_texture_t * st, uint32_t * s)
+{
+	if(st->x < 0)
+		st->x += st->width << 16;
+	if(st->y < 0)
+		st->y += st->height << 16;
+	*s = ((uint32_t *)(st->pixels + (st->y >> 16) * st->stride))[st->x >> 16];
+	st->x += st->fdx;
+	if(st->x >= st->width << 16)
+		st->x -= st->width << 16;
+	st->y += st->fdy;
+	if(st->y >= st->height << 16)
+		st->y -= st->height << 16;
+	return 1;
+}
+
+/*
+ * Samples around the same position as texture_pixel, less half a texel, and draws the same pixels,
+ * the neighbours of a texel on the border being clamped to the image
+ */
+static inline int texture_bilinear_pixel(struct cg_fused_texture_t * st, uint32_t * s)
+{
+	int px = st->x >> 16;
+	int py = st->y >> 16;
+	int x = st->x - 0x8000;
+	int y = st->y - 0x8000;
+	st->x += st->fdx;
+	st->y += st->fdy;
+	if(((unsigned int)px < (unsigned int)st->width) && ((unsigned int)py < (unsigned int)st->height))
+	{
+		int x0 = x >> 16;
+		int y0 = y >> 16;
+		int x1 = CG_MIN(x0 + 1, st->width - 1);
+		int y1 = CG_MIN(y0 + 1, st->height - 1);
+		x0 = CG_MAX(x0, 0);
+		y0 = CG_MAX(y0, 0);
+		uint32_t * r0 = (uint32_t *)(st->pixels + y0 * st->stride);
+		uint32_t * r1 = (uint32_t *)(st->pixels + y1 * st->stride);
+		*s = bilinear_pixel(r0[x0], r0[x1], r1[x0], r1[x1], (x >> 8) & 0xff, (y >> 8) & 0xff);
+		return 1;
+	}
+	return 0;
+}
+
+static inline int texture_bilinear_tiled_pixel(struct cg_fused_texture_t * st, uint32_t * s)
+{
+	if(st->x < 0)
+		st->x += st->width << 16;
+	if(st->y < 0)
+		st->y += st->height << 16;
+	int x = st->x - 0x8000;
+	int y = st->y - 0x8000;
+	if(x < 0)
+		x += st->width << 16;
+	if(y < 0)
+		y += st->height << 16;
+	int x0 = x >> 16;
+	int y0 = y >> 16;
+	int x1 = (x0 + 1 == st->width) ? 0 : x0 + 1;
+	int y1 = (y0 + 1 == st->height) ? 0 : y0 + 1;
+	uint32_t * r0 = (uint32_t *)(st->pixels + y0 * st->stride);
+	uint32_t * r1 = (uint32_t *)(st->pixels + y1 * st->stride);
+	*s = bilinear_pixel(r0[x0], r0[x1], r1[x0], r1[x1], (x >> 8) & 0xff, (y >> 8) & 0xff);
+	st->x += st->fdx;
+	if(st->x >= st->width << 16)
+		st->x -= st->width << 16;
+	st->y += st->fdy;
+	if(st->y >= st->height << 16)
+		st->y -= st->height << 16;
+	return 1;
+}
+
+CG_FUSED_KERNELS(fused_linear_pad, struct cg_fused_linear_t, linear_pad_pixel)
+CG_FUSED_KERNELS(fused_linear_reflect, struct cg_fused_linear_t, linear_reflect_pixel)
+CG_FUSED_KERNELS(fused_linear_repeat, struct cg_fused_linear_t, linear_repeat_pixel)
+CG_FUSED_KERNELS(fused_radial, struct cg_fused_radial_t, radial_pixel)
+CG_FUSED_KERNELS(fused_radial_extended, struct cg_fused_radial_t, radial_extended_pixel)
+CG_FUSED_KERNELS(fused_index, struct cg_fused_index_t, index_pixel)
+CG_FUSED_KERNELS(fused_dither, struct cg_fused_dither_t, index_dither_pixel)
+CG_FUSED_KERNELS(fused_clear, struct cg_fused_clear_t, clear_pixel)
+CG_FUSED_KERNELS(fused_texture, struct cg_fused_texture_t, texture_pixel)
+CG_FUSED_KERNELS(fused_texture_tiled, struct cg_fused_texture_t, texture_tiled_pixel)
+CG_FUSED_KERNELS(fused_texture_bilinear, struct cg_fused_texture_t, texture_bilinear_pixel)
+CG_FUSED_KERNELS(fused_texture_bilinear_tiled, struct cg_fused_texture_t, texture_bilinear_tiled_pixel)
+
+/*
+ * Composites a run of precomputed table positions
+ */
+static inline void gradient_index_span(uint32_t * dst, int length, int op, uint32_t alpha, struct cg_gradient_data_t * gradient, const int * index, int y, int x)
+{
+	if(gradient->fractions)
+	{
+		struct cg_fused_dither_t st = { gradient->colortable, gradient->fractions, index, cg_dither_matrix[y & 3], x };
+		fused_dither_map[op](dst, length, &st, alpha);
+	}
+	else
+	{
+		struct cg_fused_index_t st = { gradient->colortable, index };
+		fused_index_map[op](dst, length, &st, alpha);
+	}
+}
+
+/*
+ * Without a focal radius and with the focal point inside the end circle, the position is the
+ * positive root of a quadratic whose discriminant has no negative terms. Written as q / (s + b)
+ * it has no cancellation either, so single precision holds as long as the position stays small,
+ * which v->reach bounds from the distance to the focal point. It only pays off when sqrtf can be
+ * vectorized, that is when the library is built with -fno-math-errno.
+ */
+static inline void radial_gradient_span_float(uint32_t * dst, int length, int op, uint32_t alpha, struct cg_radial_gradient_values_t * v, struct cg_gradient_data_t * gradient, int y, int x, double rx, double ry, enum cg_spread_method_t spread)
+{
+	int size = gradient->size;
+	float inv_a = (float)(1.0 / v->a);
+	float dx = (float)(v->dx / v->a);
+	float dy = (float)(v->dy / v->a);
+	float delta_rx = (float)gradient->matrix.a;
+	float delta_ry = (float)gradient->matrix.b;
+	float px0 = (float)rx;
+	float py0 = (float)ry;
+
+	int index[64];
+	for(int j = 0; j < length; j += 64)
+	{
+		int n = CG_MIN(length - j, 64);
+		for(int i = 0; i < n; i++)
+		{
+			float px = px0 + delta_rx * (float)(i + j);
+			float py = py0 + delta_ry * (float)(i + j);
+			float b = px * dx + py * dy;
+			float q = (px * px + py * py) * inv_a;
+			float s = sqrtf(b * b + q) + b;
+			float t = q / (s > FLT_MIN ? s : FLT_MIN);
+			int ipos = (int)(t * size);
+			switch(spread)
+			{
+			case CG_SPREAD_METHOD_PAD:
+				ipos = CG_MIN(ipos, size - 1);
+				break;
+			case CG_SPREAD_METHOD_REFLECT:
+				ipos = (ipos ^ -((ipos & size) != 0)) & (size - 1);
+				break;
+			default:
+				ipos = ipos & (size - 1);
+				break;
+			}
+			index[i] = ipos;
+		}
+		gradient_index_span(dst + j, n, op, alpha, gradient, index, y, x + j);
+	}
+}
+
+/*
+ * Composites (or with CG_FUSED_STORE writes) one run of a radial gradient
+ */
+static inline void radial_gradient_span(uint32_t * dst, int length, int op, uint32_t alpha, struct cg_radial_gradient_values_t * v, struct cg_gradient_data_t * gradient, int y, int x)
+{
+	if(v->a == 0.0)
+	{
+		struct cg_fused_clear_t st = { 0 };
+		fused_clear_map[op](dst, length, &st, alpha);
+		return;
+	}
+
+	double rx = gradient->matrix.c * (y + 0.5) + gradient->matrix.tx + gradient->matrix.a * (x + 0.5);
+	double ry = gradient->matrix.d * (y + 0.5) + gradient->matrix.ty + gradient->matrix.b * (x + 0.5);
+	rx -= gradient->radial.fx;
+	ry -= gradient->radial.fy;
+
+#ifdef __NO_MATH_ERRNO__
+	if(!v->extended)
+	{
+		double ex = rx + gradient->matrix.a * length;
+		double ey = ry + gradient->matrix.b * length;
+		if(CG_MAX(rx * rx + ry * ry, ex * ex + ey * ey) * v->reach < 256.0 * 256.0)
+		{
+			switch(gradient->spread)
+			{
+			case CG_SPREAD_METHOD_PAD:
+				radial_gradient_span_float(dst, length, op, alpha, v, gradient, y, x, rx, ry, CG_SPREAD_METHOD_PAD);
+				break;
+			case CG_SPREAD_METHOD_REFLECT:
+				radial_gradient_span_float(dst, length, op, alpha, v, gradient, y, x, rx, ry, CG_SPREAD_METHOD_REFLECT);
+				break;
+			default:
+				radial_gradient_span_float(dst, length, op, alpha, v, gradient, y, x, rx, ry, CG_SPREAD_METHOD_REPEAT);
+				break;
+			}
+			return;
+		}
+	}
+#endif
+
+	double inv_a = 1.0 / (2.0 * v->a);
+	double delta_rx = gradient->matrix.a;
+	double delta_ry = gradient->matrix.b;
+
+	double b = 2 * (v->dr * gradient->radial.fr + rx * v->dx + ry * v->dy);
+	double delta_b = 2 * (delta_rx * v->dx + delta_ry * v->dy);
+	double b_delta_b = 2 * b * delta_b;
+	double delta_b_delta_b = 2 * delta_b * delta_b;
+
+	double bb = b * b;
+	double delta_bb = delta_b * delta_b;
+
+	b *= inv_a;
+	delta_b *= inv_a;
+
+	double rxrxryry = rx * rx + ry * ry;
+	double delta_rxrxryry = delta_rx * delta_rx + delta_ry * delta_ry;
+	double rx_plus_ry = 2 * (rx * delta_rx + ry * delta_ry);
+	double delta_rx_plus_ry = 2 * delta_rxrxryry;
+
+	inv_a *= inv_a;
+
+	struct cg_fused_radial_t st;
+	st.gradient = gradient;
+	st.det = (bb - 4 * v->a * (v->sqrfr - rxrxryry)) * inv_a;
+	st.delta_det = (b_delta_b + delta_bb + 4 * v->a * (rx_plus_ry + delta_rxrxryry)) * inv_a;
+	st.delta_delta_det = (delta_b_delta_b + 4 * v->a * delta_rx_plus_ry) * inv_a;
+	st.b = b;
+	st.delta_b = delta_b;
+	st.dr = v->dr;
+	st.x = x;
+	st.y = y;
+	if(v->extended)
+		fused_radial_extended_map[op](dst, length, &st, alpha);
+	else
+		fused_radial_map[op](dst, length, &st, alpha);
+}
+
+/*
+ * Composites one run of a linear gradient, returns zero when the run needs the double precision
+ * or constant colour paths of fetch_linear_gradient
+ */
+static inline int linear_gradient_span(uint32_t * dst, int length, int op, uint32_t alpha, struct cg_linear_gradient_values_t * v, struct cg_gradient_data_t * gradient, int y, int x)
+{
+	double t, inc;
+
+	linear_gradient_position(v, gradient, y, x, &t, &inc);
+	if(((inc > -1e-5) && (inc < 1e-5)) || !linear_gradient_fixed(t, inc, length))
+		return 0;
+	struct cg_fused_linear_t st = { gradient->colortable, gradient->size, (int)(t * FIXPT_SIZE), (int)(inc * FIXPT_SIZE) };
+	switch(gradient->spread)
+	{
+	case CG_SPREAD_METHOD_PAD:
+		fused_linear_pad_map[op](dst, length, &st, alpha);
+		break;
+	case CG_SPREAD_METHOD_REFLECT:
+		fused_linear_reflect_map[op](dst, length, &st, alpha);
+		break;
+	default:
+		fused_linear_repeat_map[op](dst, length, &st, alpha);
+		break;
+	}
+	return 1;
+}
+
+/*
+ * Composites one run of a dithered linear gradient through table positions
+ */
+static inline void linear_gradient_dither_span(uint32_t * dst, int length, int op, uint32_t alpha, struct cg_linear_gradient_values_t * v, struct cg_gradient_data_t * gradient, int y, int x)
+{
+	double t, inc;
+	int index[64];
+
+	linear_gradient_position(v, gradient, y, x, &t, &inc);
+	for(int j = 0; j < length; j += 64)
+	{
+		int n = CG_MIN(length - j, 64);
+		for(int i = 0; i < n; i++)
+		{
+			double pos = CG_CLAMP(t + inc * (i + j), (double)(INT_MIN >> 1), (double)(INT_MAX >> 1));
+			index[i] = gradient_clamp(gradient, (int)floor(pos + 0.5));
+		}
+		gradient_index_span(dst + j, n, op, alpha, gradient, index, y, x + j);
+	}
+}
+
+static inline void blend_solid(struct cg_surface_t * surface, enum cg_operator_t op, struct cg_rle_t * rle, uint32_t solid)
+{
+	cg_comp_solid_function_t func = cg_comp_solid_map[op];
+	int count = rle->spans.size;
+	struct cg_span_t * spans = rle->spans.data;
+	while(count--)
+	{
+		uint32_t * target = (uint32_t *)(surface->pixels + spans->y * surface->stride) + spans->x;
+		func(target, spans->len, solid, spans->coverage);
+		++spans;
+	}
 }
 
 static inline void blend_linear_gradient(struct cg_surface_t * surface, enum cg_operator_t op, struct cg_rle_t * rle, struct cg_gradient_data_t * gradient)
@@ -1755,9 +3478,94 @@ static inline void blend_linear_gradient(struct cg_surface_t * surface, enum cg_
 		v.dy /= v.l;
 		v.off = -v.dx * gradient->linear.x1 - v.dy * gradient->linear.y1;
 	}
+	v.fetch = cg_fetch_linear_map[gradient->spread];
 
+	/*
+	 * When the position does not change along x every span is a single colour, and when it does
+	 * not change along y all rows are the same, so one row fetched over the extents serves them all
+	 */
+	double xinc = 0, yinc = 0;
+	if(v.l != 0.0)
+	{
+		xinc = (v.dx * gradient->matrix.a + v.dy * gradient->matrix.b) * gradient->size;
+		yinc = (v.dx * gradient->matrix.c + v.dy * gradient->matrix.d) * gradient->size;
+	}
 	int count = rle->spans.size;
 	struct cg_span_t * spans = rle->spans.data;
+	if(gradient->fractions)
+	{
+		int fused = cg_fused_enabled(op);
+		while(count--)
+		{
+			int length = spans->len;
+			int x = spans->x;
+			while(length)
+			{
+				int l = CG_MIN(length, 1024);
+				uint32_t * target = (uint32_t *)(surface->pixels + spans->y * surface->stride) + x;
+				if(fused)
+				{
+					linear_gradient_dither_span(target, l, op, spans->coverage, &v, gradient, spans->y, x);
+				}
+				else
+				{
+					linear_gradient_dither_span(buffer, l, CG_FUSED_STORE, 255, &v, gradient, spans->y, x);
+					func(target, l, buffer, spans->coverage);
+				}
+				x += l;
+				length -= l;
+			}
+			++spans;
+		}
+		return;
+	}
+	if((xinc > -1e-5) && (xinc < 1e-5))
+	{
+		cg_comp_solid_function_t solid = cg_comp_solid_map[op];
+		while(count--)
+		{
+			uint32_t color;
+			fetch_linear_gradient(&color, &v, gradient, spans->y, spans->x, 1);
+			uint32_t * target = (uint32_t *)(surface->pixels + spans->y * surface->stride) + spans->x;
+			solid(target, spans->len, color, spans->coverage);
+			++spans;
+		}
+		return;
+	}
+	if(fabs(yinc) < 1e-3)
+	{
+		/*
+		 * The extents are taken from the spans themselves, which need not be sorted
+		 */
+		int x1 = INT_MAX, y1 = INT_MAX;
+		int x2 = INT_MIN, y2 = INT_MIN;
+		for(int i = 0; i < count; i++)
+		{
+			x1 = CG_MIN(x1, spans[i].x);
+			x2 = CG_MAX(x2, spans[i].x + spans[i].len);
+			y1 = CG_MIN(y1, spans[i].y);
+			y2 = CG_MAX(y2, spans[i].y);
+		}
+		int w = x2 - x1;
+		uint32_t * row = NULL;
+		if(fabs(yinc * (y2 - y1 + 1)) < 1e-3)
+			row = (w > 1024) ? malloc((size_t)w * sizeof(uint32_t)) : buffer;
+		if(row)
+		{
+			fetch_linear_gradient(row, &v, gradient, y1, x1, w);
+			while(count--)
+			{
+				uint32_t * target = (uint32_t *)(surface->pixels + spans->y * surface->stride) + spans->x;
+				func(target, spans->len, row + (spans->x - x1), spans->coverage);
+				++spans;
+			}
+			if(row != buffer)
+				free(row);
+			return;
+		}
+	}
+
+	int fused = cg_fused_enabled(op) && (v.fetch == cg_fetch_linear_portable_map[gradient->spread]);
 	while(count--)
 	{
 		int length = spans->len;
@@ -1765,9 +3573,12 @@ static inline void blend_linear_gradient(struct cg_surface_t * surface, enum cg_
 		while(length)
 		{
 			int l = CG_MIN(length, 1024);
-			fetch_linear_gradient(buffer, &v, gradient, spans->y, x, l);
 			uint32_t * target = (uint32_t *)(surface->pixels + spans->y * surface->stride) + x;
-			func(target, l, buffer, spans->coverage);
+			if(!fused || !linear_gradient_span(target, l, op, spans->coverage, &v, gradient, spans->y, x))
+			{
+				fetch_linear_gradient(buffer, &v, gradient, spans->y, x, l);
+				func(target, l, buffer, spans->coverage);
+			}
 			x += l;
 			length -= l;
 		}
@@ -1788,7 +3599,84 @@ static inline void blend_radial_gradient(struct cg_surface_t * surface, enum cg_
 	v.a = v.dr * v.dr - v.dx * v.dx - v.dy * v.dy;
 	v.inv2a = 1.0 / (2.0 * v.a);
 	v.extended = gradient->radial.fr != 0.0 || v.a <= 0.0;
+	v.reach = v.extended ? 0.0 : 4.0 * ((v.dx * v.dx + v.dy * v.dy) / (v.a * v.a) + 1.0 / v.a);
+
+	int fused = cg_fused_enabled(op);
+	int count = rle->spans.size;
+	struct cg_span_t * spans = rle->spans.data;
+	while(count--)
+	{
+		int length = spans->len;
+		int x = spans->x;
+		while(length)
+		{
+			int l = CG_MIN(length, 1024);
+			uint32_t * target = (uint32_t *)(surface->pixels + spans->y * surface->stride) + x;
+			if(fused)
+			{
+				radial_gradient_span(target, l, op, spans->coverage, &v, gradient, spans->y, x);
+			}
+			else
+			{
+				radial_gradient_span(buffer, l, CG_FUSED_STORE, 255, &v, gradient, spans->y, x);
+				func(target, l, buffer, spans->coverage);
+			}
+			x += l;
+			length -= l;
+		}
+		++spans;
+	}
+}
+
+/*
+ * The angle comes from a polynomial arctangent of the smaller over the larger coordinate, folded
+ * out to the full circle by the signs and the octant, good to about 1e-5 radians. Positions are
+ * worked out in float for blocks of pixels, which the compiler vectorizes, and then composited
+ * through the index kernels.
+ */
+static inline void conic_gradient_span(uint32_t * dst, int length, int op, uint32_t alpha, struct cg_gradient_data_t * gradient, int y, int x)
+{
+	double rx = gradient->matrix.c * (y + 0.5) + gradient->matrix.a * (x + 0.5) + gradient->matrix.tx - gradient->conic.cx;
+	double ry = gradient->matrix.d * (y + 0.5) + gradient->matrix.b * (x + 0.5) + gradient->matrix.ty - gradient->conic.cy;
+	double start = gradient->conic.angle / (2 * M_PI);
+	float px0 = (float)rx;
+	float py0 = (float)ry;
+	float delta_rx = (float)gradient->matrix.a;
+	float delta_ry = (float)gradient->matrix.b;
+	float offset = (float)(start - floor(start));
+	int size = gradient->size;
+
+	int index[64];
+	for(int j = 0; j < length; j += 64)
+	{
+		int n = CG_MIN(length - j, 64);
+		for(int i = 0; i < n; i++)
+		{
+			float px = px0 + delta_rx * (float)(i + j);
+			float py = py0 + delta_ry * (float)(i + j);
+			float ax = fabsf(px);
+			float ay = fabsf(py);
+			float hi = CG_MAX(ax, ay);
+			float a = CG_MIN(ax, ay) / (hi > FLT_MIN ? hi : FLT_MIN);
+			float s = a * a;
+			float r = ((-0.0464964749f * s + 0.15931422f) * s - 0.327622764f) * s * a + a;
+			r = (ay > ax) ? 0.25f - r * (float)(0.5 / M_PI) : r * (float)(0.5 / M_PI);
+			r = (px < 0) ? 0.5f - r : r;
+			r = (py < 0) ? 1.0f - r : r;
+			r -= offset;
+			r = (r < 0) ? r + 1.0f : r;
+			index[i] = CG_MIN((int)(r * size), size - 1);
+		}
+		gradient_index_span(dst + j, n, op, alpha, gradient, index, y, x + j);
+	}
+}
+
+static inline void blend_conic_gradient(struct cg_surface_t * surface, enum cg_operator_t op, struct cg_rle_t * rle, struct cg_gradient_data_t * gradient)
+{
+	cg_comp_function_t func = cg_comp_map[op];
+	uint32_t buffer[1024];
 
+	int fused = cg_fused_enabled(op);
 	int count = rle->spans.size;
 	struct cg_span_t * spans = rle->spans.data;
 	while(count--)
@@ -1798,9 +3686,16 @@ static inline void blend_radial_gradient(struct cg_surface_t * surface, enum cg_
 		while(length)
 		{
 			int l = CG_MIN(length, 1024);
-			fetch_radial_gradient(buffer, &v, gradient, spans->y, x, l);
 			uint32_t * target = (uint32_t *)(surface->pixels + spans->y * surface->stride) + x;
-			func(target, l, buffer, spans->coverage);
+			if(fused)
+			{
+				conic_gradient_span(target, l, op, spans->coverage, gradient, spans->y, x);
+			}
+			else
+			{
+				conic_gradient_span(buffer, l, CG_FUSED_STORE, 255, gradient, spans->y, x);
+				func(target, l, buffer, spans->coverage);
+			}
 			x += l;
 			length -= l;
 		}
@@ -1856,6 +3751,9 @@ static inline void blend_transformed_argb(struct cg_surface_t * surface, enum cg
 	int image_height = texture->height;
 	int fdx = (int)(texture->matrix.a * FIXED_SCALE);
 	int fdy = (int)(texture->matrix.b * FIXED_SCALE);
+	int fused = cg_fused_enabled(op);
+	int bilinear = (texture->filter == CG_TEXTURE_FILTER_BILINEAR);
+	struct cg_fused_texture_t st = { texture->pixels, texture->stride, image_width, image_height, 0, 0, fdx, fdy };
 	int count = rle->spans.size;
 	struct cg_span_t * spans = rle->spans.data;
 	while(count--)
@@ -1867,6 +3765,17 @@ static inline void blend_transformed_argb(struct cg_surface_t * surface, enum cg
 		int y = (int)((texture->matrix.d * cy + texture->matrix.b * cx + texture->matrix.ty) * FIXED_SCALE);
 		int length = spans->len;
 		int coverage = (spans->coverage * texture->alpha) >> 8;
+		if(fused)
+		{
+			st.x = x;
+			st.y = y;
+			if(bilinear)
+				fused_texture_bilinear_map[op](target, length, &st, coverage);
+			else
+				fused_texture_map[op](target, length, &st, coverage);
+			++spans;
+			continue;
+		}
 		while(length)
 		{
 			int l = CG_MIN(length, 1024);
@@ -1876,12 +3785,22 @@ static inline void blend_transformed_argb(struct cg_surface_t * surface, enum cg
 			int clen = 0;
 			while(b < end)
 			{
-				int px = x >> 16;
-				int py = y >> 16;
-				if(((unsigned int)px < (unsigned int)image_width) && ((unsigned int)py < (unsigned int)image_height))
+				if(bilinear)
 				{
-					*b = ((uint32_t *)(texture->pixels + py * texture->stride))[px];
-					clen++;
+					st.x = x;
+					st.y = y;
+					if(texture_bilinear_pixel(&st, b))
+						clen++;
+				}
+				else
+				{
+					int px = x >> 16;
+					int py = y >> 16;
+					if(((unsigned int)px < (unsigned int)image_width) && ((unsigned int)py < (unsigned int)image_height))
+					{
+						*b = ((uint32_t *)(texture->pixels + py * texture->stride))[px];
+						clen++;
+					}
 				}
 				x += fdx;
 				y += fdy;
@@ -1948,6 +3867,9 @@ static inline void blend_transformed_tiled_argb(struct cg_surface_t * surface, e
 	int scanline_offset = texture->stride / 4;
 	int fdx = (int)(texture->matrix.a * FIXED_SCALE);
 	int fdy = (int)(texture->matrix.b * FIXED_SCALE);
+	int fused = cg_fused_enabled(op);
+	int bilinear = (texture->filter == CG_TEXTURE_FILTER_BILINEAR);
+	struct cg_fused_texture_t st = { texture->pixels, texture->stride, image_width, image_height, 0, 0, fdx % (image_width << 16), fdy % (image_height << 16) };
 	int count = rle->spans.size;
 	struct cg_span_t * spans = rle->spans.data;
 	while(count--)
@@ -1963,6 +3885,32 @@ static inline void blend_transformed_tiled_argb(struct cg_surface_t * surface, e
 		while(length)
 		{
 			int l = CG_MIN(length, 1024);
+			if(fused)
+			{
+				st.x = x % (image_width << 16);
+				st.y = y % (image_height << 16);
+				if(bilinear)
+					fused_texture_bilinear_tiled_map[op](target, l, &st, coverage);
+				else
+					fused_texture_tiled_map[op](target, l, &st, coverage);
+				x += fdx * l;
+				y += fdy * l;
+				target += l;
+				length -= l;
+				continue;
+			}
+			if(bilinear)
+			{
+				st.x = x % (image_width << 16);
+				st.y = y % (image_height << 16);
+				fused_texture_bilinear_tiled_map[CG_FUSED_STORE](buffer, l, &st, 255);
+				func(target, l, buffer, coverage);
+				x += fdx * l;
+				y += fdy * l;
+				target += l;
+				length -= l;
+				continue;
+			}
 			uint32_t * end = buffer + l;
 			uint32_t * b = buffer;
 			int px16 = x % (image_width << 16);
@@ -1998,74 +3946,251 @@ static inline void blend_transformed_tiled_argb(struct cg_surface_t * surface, e
 	}
 }
 
-static inline void cg_blend_color(struct cg_ctx_t * ctx, struct cg_rle_t * rle, struct cg_color_t * color)
+static inline void cg_blend_color(struct cg_ctx_t * ctx, struct cg_rle_t * rle, enum cg_operator_t op, struct cg_color_t * color, double opacity)
 {
 	if(color)
-	{
-		struct cg_state_t * state = ctx->state;
-		uint32_t solid = premultiply_color(color, state->opacity);
-		if((CG_ALPHA(solid) == 255) && (state->op == CG_OPERATOR_SRC_OVER))
-			blend_solid(ctx->surface, CG_OPERATOR_SRC, rle, solid);
-		else
-			blend_solid(ctx->surface, state->op, rle, solid);
-	}
+		blend_solid(ctx->surface, op, rle, premultiply_color(color, opacity));
 }
 
-static inline void cg_blend_gradient(struct cg_ctx_t * ctx, struct cg_rle_t * rle, struct cg_gradient_t * gradient)
+/*
+ * The table gets about one entry per device pixel the stops are spread over, rounded up to a
+ * power of two between 256 and 4096 entries, so short gradients touch less memory and long
+ * ones do not step
+ */
+static inline int gradient_table_size(struct cg_gradient_t * gradient, struct cg_matrix_t * m, struct cg_rle_t * rle)
 {
-	if(gradient && (gradient->stops.size > 0))
+	double length;
+	if(gradient->type == CG_GRADIENT_TYPE_LINEAR)
 	{
-		struct cg_state_t * state = ctx->state;
-		struct cg_gradient_data_t data;
-		int i, pos = 0, nstop = gradient->stops.size;
-		struct cg_gradient_stop_t *curr, *next, *start, *last;
-		uint32_t curr_color, next_color, last_color;
-		uint32_t dist, idist;
-		double delta, t, incr, fpos;
-		double opacity = state->opacity * gradient->opacity;
-
-		start = gradient->stops.data;
-		curr = start;
-		curr_color = combine_opacity(&curr->color, opacity);
-
-		data.colortable[pos] = premultiply_pixel(curr_color);
-		++pos;
-		incr = 1.0 / 1024;
-		fpos = 1.5 * incr;
+		double dx = gradient->values[2] - gradient->values[0];
+		double dy = gradient->values[3] - gradient->values[1];
+		double px = m->a * dx + m->c * dy;
+		double py = m->b * dx + m->d * dy;
+		length = sqrt(px * px + py * py);
+	}
+	else if(gradient->type == CG_GRADIENT_TYPE_CONIC)
+	{
+		double cx = m->a * gradient->values[0] + m->c * gradient->values[1] + m->tx;
+		double cy = m->b * gradient->values[0] + m->d * gradient->values[1] + m->ty;
+		double dx = CG_MAX(fabs(rle->x - cx), fabs(rle->x + rle->w - cx));
+		double dy = CG_MAX(fabs(rle->y - cy), fabs(rle->y + rle->h - cy));
+		length = 2 * M_PI * sqrt(dx * dx + dy * dy);
+	}
+	else
+	{
+		double scale = sqrt(CG_MAX(m->a * m->a + m->b * m->b, m->c * m->c + m->d * m->d));
+		double dx = gradient->values[0] - gradient->values[3];
+		double dy = gradient->values[1] - gradient->values[4];
+		length = (fabs(gradient->values[2] - gradient->values[5]) + sqrt(dx * dx + dy * dy)) * scale;
+	}
+	int size = CG_GRADIENT_TABLE_MIN;
+	while((size < length) && (size < CG_GRADIENT_TABLE_MAX))
+		size <<= 1;
+	return size;
+}
+
+/*
+ * Rebuilds the table in double precision, sampling entry i at the middle of its interval, keeping four
+ * bits of the remainder of every channel for dither_color
+ */
+static inline void gradient_dither_table(struct cg_gradient_t * gradient, double opacity, uint32_t * colortable, uint16_t * fractions, int size)
+{
+	struct cg_gradient_stop_t * stops = gradient->stops.data;
+	int nstop = gradient->stops.size;
+	int i = 0;
+
+	for(int pos = 0; pos < size; pos++)
+	{
+		double fpos = (pos + 0.5) / size;
+		double c[4];
+		while((i < nstop) && (stops[i].offset <= fpos))
+			i++;
+		if((i == 0) || (i == nstop))
+		{
+			struct cg_color_t * color = &stops[i == 0 ? 0 : nstop - 1].color;
+			c[0] = color->a;
+			c[1] = color->r;
+			c[2] = color->g;
+			c[3] = color->b;
+		}
+		else
+		{
+			struct cg_color_t * c0 = &stops[i - 1].color;
+			struct cg_color_t * c1 = &stops[i].color;
+			double u = (fpos - stops[i - 1].offset) / (stops[i].offset - stops[i - 1].offset);
+			c[0] = c0->a + (c1->a - c0->a) * u;
+			c[1] = c0->r + (c1->r - c0->r) * u;
+			c[2] = c0->g + (c1->g - c0->g) * u;
+			c[3] = c0->b + (c1->b - c0->b) * u;
+		}
+		double a = CG_CLAMP(c[0] * opacity, 0.0, 1.0) * 255;
+		uint32_t color = 0, fraction = 0;
+		for(int k = 0; k < 4; k++)
+		{
+			double value = (k == 0) ? a : CG_CLAMP(c[k], 0.0, 1.0) * a;
+			double level = floor(value);
+			color = (color << 8) | (uint32_t)level;
+			fraction = (fraction << 4) | (uint32_t)((value - level) * 16);
+		}
+		colortable[pos] = color;
+		fractions[pos] = (uint16_t)fraction;
+	}
+}
+
+/*
+ * Index of the last stop at or before offset, searching from stop lo on, or lo - 1 when there is
+ * none. Consecutive runs usually move on by a stop or two, so the range is first widened from lo
+ * in doubling steps and then halved.
+ */
+static inline int gradient_find_stop(struct cg_gradient_stop_t * stops, int lo, int hi, double offset)
+{
+	int step = 1;
+	lo--;
+	while((lo + step < hi) && (stops[lo + step].offset <= offset))
+	{
+		lo += step;
+		step <<= 1;
+	}
+	hi = CG_MIN(lo + step, hi);
+	while(hi - lo > 1)
+	{
+		int mid = (lo + hi) / 2;
+		if(stops[mid].offset <= offset)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Fills len entries between two unpremultiplied colours. Each channel is stepped in 16.16 fixed
+ * point from u0, the position of the first entry within the segment, by du per entry, then red
+ * and blue are premultiplied together as in CG_BYTE_MUL and divided by 255 with the rounding
+ * shifts of CG_DIV255. The loop has no divisions or branches and is vectorized.
+ */
+static inline int32_t gradient_fixed(double v)
+{
+	return (int32_t)(v < 0 ? v - 0.5 : v + 0.5);
+}
 
-		while(fpos <= curr->offset)
+static inline void gradient_fill_segment(uint32_t * colortable, int len, uint32_t c0, uint32_t c1, double u0, double du)
+{
+	int32_t a0 = CG_ALPHA(c0), da = (int32_t)CG_ALPHA(c1) - a0;
+	int32_t r0 = (c0 >> 16) & 0xff, dr = (int32_t)((c1 >> 16) & 0xff) - r0;
+	int32_t g0 = (c0 >> 8) & 0xff, dg = (int32_t)((c1 >> 8) & 0xff) - g0;
+	int32_t b0 = c0 & 0xff, db = (int32_t)(c1 & 0xff) - b0;
+	int32_t sa = gradient_fixed((a0 + da * u0) * 65536.0), ia = gradient_fixed(da * du * 65536.0);
+	int32_t sr = gradient_fixed((r0 + dr * u0) * 65536.0), ir = gradient_fixed(dr * du * 65536.0);
+	int32_t sg = gradient_fixed((g0 + dg * u0) * 65536.0), ig = gradient_fixed(dg * du * 65536.0);
+	int32_t sb = gradient_fixed((b0 + db * u0) * 65536.0), ib = gradient_fixed(db * du * 65536.0);
+
+	for(int i = 0; i < len; i++)
+	{
+		uint32_t a = (uint32_t)(sa + 0x8000) >> 16;
+		uint32_t r = (uint32_t)(sr + 0x8000) >> 16;
+		uint32_t g = (uint32_t)(sg + 0x8000) >> 16;
+		uint32_t b = (uint32_t)(sb + 0x8000) >> 16;
+		uint32_t rb = ((r << 16) | b) * a;
+		uint32_t ga = g * a;
+		rb = ((rb + ((rb >> 8) & 0x00ff00ff) + 0x00800080) >> 8) & 0x00ff00ff;
+		ga = (ga + (ga >> 8) + 0x80) & 0xff00;
+		colortable[i] = (a << 24) | rb | ga;
+		sa += ia;
+		sr += ir;
+		sg += ig;
+		sb += ib;
+	}
+}
+
+/*
+ * Entry i holds the colour at offset (i + 0.5) / size. Runs of entries are filled one stop segment
+ * at a time, the segment of a run is found by binary search so stops that fall between two
+ * entries cost nothing.
+ */
+static void gradient_build_table(struct cg_gradient_t * gradient, double opacity, uint32_t * colortable, int size)
+{
+	struct cg_gradient_stop_t * stops = gradient->stops.data;
+	int nstop = gradient->stops.size;
+	int pos = 0, i = -1, prev;
+	uint32_t curr_color = 0, next_color = combine_opacity(&stops[0].color, opacity);
+
+	while(pos < size)
+	{
+		double fpos = (pos + 0.5) / size;
+		prev = i;
+		i = gradient_find_stop(stops, CG_MAX(i, 0), nstop, fpos);
+		if(i >= 0)
+			curr_color = (i == prev + 1) ? next_color : combine_opacity(&stops[i].color, opacity);
+		if(i == nstop - 1)
 		{
-			data.colortable[pos] = data.colortable[pos - 1];
-			++pos;
-			fpos += incr;
+			gradient_fill_segment(colortable + pos, size - pos, curr_color, curr_color, 0, 0);
+			break;
 		}
-		for(i = 0; i < nstop - 1; i++)
+		struct cg_gradient_stop_t * next = &stops[i + 1];
+		double e = next->offset * size - 0.5;
+		int end = (int)e;
+		end = CG_CLAMP(end < e ? end + 1 : end, pos + 1, size);
+		if(i < 0)
 		{
-			curr = (start + i);
-			next = (start + i + 1);
-			delta = 1.0 / (next->offset - curr->offset);
+			gradient_fill_segment(colortable + pos, end - pos, next_color, next_color, 0, 0);
+		}
+		else
+		{
+			struct cg_gradient_stop_t * curr = &stops[i];
+			double delta = 1.0 / (next->offset - curr->offset);
 			next_color = combine_opacity(&next->color, opacity);
-			while(fpos < next->offset && pos < 1024)
-			{
-				t = (fpos - curr->offset) * delta;
-				dist = (uint32_t)(255 * t);
-				idist = 255 - dist;
-				data.colortable[pos] = premultiply_pixel(interpolate_pixel(curr_color, idist, next_color, dist));
-				++pos;
-				fpos += incr;
-			}
-			curr_color = next_color;
+			gradient_fill_segment(colortable + pos, end - pos, curr_color, next_color, (fpos - curr->offset) * delta, delta / size);
 		}
+		pos = end;
+	}
+}
 
-		last = start + nstop - 1;
-		last_color = premultiply_color(&last->color, opacity);
-		for(; pos < 1024; ++pos)
-			data.colortable[pos] = last_color;
+static inline void cg_blend_gradient(struct cg_ctx_t * ctx, struct cg_rle_t * rle, enum cg_operator_t op, struct cg_gradient_t * gradient)
+{
+	if(gradient && (gradient->stops.size > 0))
+	{
+		struct cg_state_t * state = ctx->state;
+		struct cg_gradient_data_t data;
+		uint32_t colortable[1024];
+		uint16_t fractions[1024];
+		double opacity = state->opacity * gradient->opacity;
 
 		data.spread = gradient->spread;
 		data.matrix = gradient->matrix;
 		cg_matrix_multiply(&data.matrix, &data.matrix, &state->matrix);
+		data.size = gradient_table_size(gradient, &data.matrix, rle);
 		cg_matrix_invert(&data.matrix);
+		data.colortable = colortable;
+		data.fractions = gradient->dither ? fractions : NULL;
+		if(data.size > 1024)
+		{
+			/*
+			 * Without memory for the larger table the stack one does, a little coarser
+			 */
+			uint32_t * c = malloc((size_t)data.size * sizeof(uint32_t));
+			uint16_t * f = gradient->dither ? malloc((size_t)data.size * sizeof(uint16_t)) : NULL;
+			if(c && (f || !gradient->dither))
+			{
+				data.colortable = c;
+				if(f)
+					data.fractions = f;
+			}
+			else
+			{
+				free(c);
+				free(f);
+				data.size = 1024;
+			}
+		}
+		if(gradient->dither)
+		{
+			gradient_dither_table(gradient, opacity, data.colortable, data.fractions, data.size);
+		}
+		else
+		{
+			gradient_build_table(gradient, opacity, data.colortable, data.size);
+		}
 
 		if(gradient->type == CG_GRADIENT_TYPE_LINEAR)
 		{
@@ -2073,7 +4198,14 @@ static inline void cg_blend_gradient(struct cg_ctx_t * ctx, struct cg_rle_t * rl
 			data.linear.y1 = gradient->values[1];
 			data.linear.x2 = gradient->values[2];
 			data.linear.y2 = gradient->values[3];
-			blend_linear_gradient(ctx->surface, state->op, rle, &data);
+			blend_linear_gradient(ctx->surface, op, rle, &data);
+		}
+		else if(gradient->type == CG_GRADIENT_TYPE_CONIC)
+		{
+			data.conic.cx = gradient->values[0];
+			data.conic.cy = gradient->values[1];
+			data.conic.angle = gradient->values[2];
+			blend_conic_gradient(ctx->surface, op, rle, &data);
 		}
 		else
 		{
@@ -2083,41 +4215,157 @@ static inline void cg_blend_gradient(struct cg_ctx_t * ctx, struct cg_rle_t * rl
 			data.radial.fx = gradient->values[3];
 			data.radial.fy = gradient->values[4];
 			data.radial.fr = gradient->values[5];
-			blend_radial_gradient(ctx->surface, state->op, rle, &data);
+			blend_radial_gradient(ctx->surface, op, rle, &data);
 		}
+		if(data.colortable != colortable)
+			free(data.colortable);
+		if(data.fractions && (data.fractions != fractions))
+			free(data.fractions);
 	}
 }
 
-static inline void cg_blend_texture(struct cg_ctx_t * ctx, struct cg_rle_t * rle, struct cg_texture_t * texture)
+static inline void cg_blend_texture(struct cg_ctx_t * ctx, struct cg_rle_t * rle, enum cg_operator_t op, struct cg_texture_t * texture)
 {
 	if(texture)
 	{
 		struct cg_state_t * state = ctx->state;
+		struct cg_surface_t * surface = texture->surface;
 		struct cg_texture_data_t data;
-		data.width = texture->surface->width;
-		data.height = texture->surface->height;
-		data.stride = texture->surface->stride;
 		data.alpha = (int)(state->opacity * texture->opacity * 256.0);
-		data.pixels = texture->surface->pixels;
+		data.filter = texture->filter;
 		data.matrix = texture->matrix;
 		cg_matrix_multiply(&data.matrix, &data.matrix, &state->matrix);
 		cg_matrix_invert(&data.matrix);
-		struct cg_matrix_t * m = &data.matrix;
-		if((m->a == 1.0) && (m->b == 0.0) && (m->c == 0.0) && (m->d == 1.0))
+		if(data.filter == CG_TEXTURE_FILTER_MIPMAP)
+		{
+			/*
+			 * Halves the image while a device pixel spans two texels or more and samples
+			 * that level bilinearly, mapping the texture onto it edge to edge
+			 */
+			struct cg_matrix_t * m = &data.matrix;
+			double scale = sqrt(CG_MAX(m->a * m->a + m->b * m->b, m->c * m->c + m->d * m->d));
+			struct cg_surface_t * mipmap;
+			while((scale >= 2.0) && (mipmap = cg_surface_mipmap(surface)))
+			{
+				surface = mipmap;
+				scale *= 0.5;
+			}
+			if(surface != texture->surface)
+			{
+				double kx = (double)surface->width / texture->surface->width;
+				double ky = (double)surface->height / texture->surface->height;
+				m->a *= kx;
+				m->c *= kx;
+				m->tx *= kx;
+				m->b *= ky;
+				m->d *= ky;
+				m->ty *= ky;
+				m->type = CG_MATRIX_TYPE_UNKNOWN;
+			}
+			data.filter = CG_TEXTURE_FILTER_BILINEAR;
+		}
+		data.width = surface->width;
+		data.height = surface->height;
+		data.stride = surface->stride;
+		data.pixels = surface->pixels;
+		if((cg_matrix_get_type(&data.matrix) <= CG_MATRIX_TYPE_TRANSLATE) && ((data.filter == CG_TEXTURE_FILTER_NEAREST)
+			|| ((data.matrix.tx == floor(data.matrix.tx)) && (data.matrix.ty == floor(data.matrix.ty)))))
 		{
 			if(texture->type == CG_TEXTURE_TYPE_PLAIN)
-				blend_untransformed_argb(ctx->surface, state->op, rle, &data);
+				blend_untransformed_argb(ctx->surface, op, rle, &data);
 			else
-				blend_untransformed_tiled_argb(ctx->surface, state->op, rle, &data);
+				blend_untransformed_tiled_argb(ctx->surface, op, rle, &data);
 		}
 		else
 		{
 			if(texture->type == CG_TEXTURE_TYPE_PLAIN)
-				blend_transformed_argb(ctx->surface, state->op, rle, &data);
+				blend_transformed_argb(ctx->surface, op, rle, &data);
 			else
-				blend_transformed_tiled_argb(ctx->surface, state->op, rle, &data);
+				blend_transformed_tiled_argb(ctx->surface, op, rle, &data);
+		}
+		/*
+		 * The pixels of an untracked surface can change behind the library's back, so its levels last one draw
+		 */
+		if(!texture->surface->tracked)
+			cg_surface_mark_dirty(texture->surface);
+	}
+}
+
+/*
+ * Every pixel of a linear or conic gradient, and of a radial one without a focal radius and with
+ * the focal point inside the end circle, is a table colour
+ */
+static inline int cg_gradient_covers(struct cg_gradient_t * gradient)
+{
+	if(gradient->type != CG_GRADIENT_TYPE_RADIAL)
+		return 1;
+	double dx = gradient->values[0] - gradient->values[3];
+	double dy = gradient->values[1] - gradient->values[4];
+	double dr = gradient->values[2] - gradient->values[5];
+	return (gradient->values[5] == 0.0) && (dr * dr - dx * dx - dy * dy > 0.0);
+}
+
+/*
+ * Looks at the paint before blending. Returns zero when the draw cannot change the destination,
+ * otherwise sets the operator to use, which is SRC in place of SRC_OVER when every pixel of the
+ * paint is opaque, and sets color when a gradient has a single colour and can be drawn solid.
+ */
+static int cg_paint_analyze(struct cg_state_t * state, enum cg_operator_t * op, struct cg_color_t ** color, double * opacity)
+{
+	struct cg_paint_t * paint = &state->paint;
+	double lo, hi, scale = 255.0;
+
+	*op = state->op;
+	*color = NULL;
+	*opacity = state->opacity;
+	switch(paint->type)
+	{
+	case CG_PAINT_TYPE_COLOR:
+		*color = &paint->color;
+		lo = hi = paint->color.a * *opacity;
+		break;
+	case CG_PAINT_TYPE_GRADIENT:
+	{
+		struct cg_gradient_t * gradient = &paint->gradient;
+		struct cg_gradient_stop_t * stops = gradient->stops.data;
+		int nstop = gradient->stops.size;
+		int single = 1;
+		if(nstop == 0)
+			return 0;
+		*opacity *= gradient->opacity;
+		lo = hi = stops[0].color.a;
+		for(int i = 1; i < nstop; i++)
+		{
+			struct cg_color_t * c = &stops[i].color;
+			lo = CG_MIN(lo, c->a);
+			hi = CG_MAX(hi, c->a);
+			if((c->r != stops[0].color.r) || (c->g != stops[0].color.g) || (c->b != stops[0].color.b) || (c->a != stops[0].color.a))
+				single = 0;
 		}
+		lo *= *opacity;
+		hi *= *opacity;
+		if(!cg_gradient_covers(gradient))
+			lo = 0;
+		else if(single)
+			*color = &stops[0].color;
+		if(gradient->dither)
+			scale = 255.0 * 16.0;
+		break;
+	}
+	case CG_PAINT_TYPE_TEXTURE:
+		*opacity *= paint->texture.opacity;
+		hi = *opacity;
+		lo = (paint->texture.surface && cg_surface_is_opaque(paint->texture.surface)) ? hi : 0;
+		scale = 256.0;
+		break;
+	default:
+		return 0;
 	}
+	if((hi * scale < 1.0) && ((*op == CG_OPERATOR_SRC_OVER) || (*op == CG_OPERATOR_DST_OUT)))
+		return 0;
+	if((lo >= 1.0) && (*op == CG_OPERATOR_SRC_OVER))
+		*op = CG_OPERATOR_SRC;
+	return 1;
 }
 
 static void cg_blend(struct cg_ctx_t * ctx, struct cg_rle_t * rle)
@@ -2125,19 +4373,29 @@ static void cg_blend(struct cg_ctx_t * ctx, struct cg_rle_t * rle)
 	if(rle && (rle->spans.size > 0))
 	{
 		struct cg_paint_t * source = &ctx->state->paint;
-		switch(source->type)
+		struct cg_color_t * color;
+		enum cg_operator_t op;
+		double opacity;
+		if(!cg_paint_analyze(ctx->state, &op, &color, &opacity))
+			return;
+		if(color)
 		{
-		case CG_PAINT_TYPE_COLOR:
-			cg_blend_color(ctx, rle, &source->color);
-			break;
-		case CG_PAINT_TYPE_GRADIENT:
-			cg_blend_gradient(ctx, rle, &source->gradient);
-			break;
-		case CG_PAINT_TYPE_TEXTURE:
-			cg_blend_texture(ctx, rle, &source->texture);
-		default:
-			break;
+			cg_blend_color(ctx, rle, op, color, opacity);
+		}
+		else
+		{
+			switch(source->type)
+			{
+			case CG_PAINT_TYPE_GRADIENT:
+				cg_blend_gradient(ctx, rle, op, &source->gradient);
+				break;
+			case CG_PAINT_TYPE_TEXTURE:
+				cg_blend_texture(ctx, rle, op, &source->texture);
+			default:
+				break;
+			}
 		}
+		cg_surface_mark_dirty(ctx->surface);
 	}
 }
 
@@ -2155,6 +4413,7 @@ static struct cg_state_t * cg_state_create(void)
 	state->stroke.dash = NULL;
 	state->op = CG_OPERATOR_SRC_OVER;
 	state->opacity = 1.0;
+	state->quality = CG_INSTANCE_QUALITY_GOOD;
 	state->next = NULL;
 	return state;
 }
@@ -2173,6 +4432,7 @@ static struct cg_state_t * cg_state_clone(struct cg_state_t * state)
 	newstate->stroke.dash = cg_dash_clone(state->stroke.dash);
 	newstate->op = state->op;
 	newstate->opacity = state->opacity;
+	newstate->quality = state->quality;
 	newstate->next = NULL;
 	return newstate;
 }
@@ -2199,6 +4459,7 @@ struct cg_ctx_t * cg_create(struct cg_surface_t * surface)
 	ctx->clip.h = surface->height;
 	ctx->outline_data = NULL;
 	ctx->outline_size = 0;
+	memset(&ctx->masks, 0, sizeof(struct cg_mask_cache_t));
 	return ctx;
 }
 
@@ -2216,6 +4477,7 @@ void cg_destroy(struct cg_ctx_t * ctx)
 		cg_path_destroy(ctx->path);
 		cg_rle_destroy(ctx->rle);
 		cg_rle_destroy(ctx->clippath);
+		cg_mask_cache_set_budget(ctx, 0);
 		if(ctx->outline_data)
 			free(ctx->outline_data);
 		free(ctx);
@@ -2270,6 +4532,14 @@ struct cg_gradient_t * cg_set_source_radial_gradient(struct cg_ctx_t * ctx, doub
 	return &paint->gradient;
 }
 
+struct cg_gradient_t * cg_set_source_conic_gradient(struct cg_ctx_t * ctx, double cx, double cy, double angle)
+{
+	struct cg_paint_t * paint = &ctx->state->paint;
+	paint->type = CG_PAINT_TYPE_GRADIENT;
+	cg_gradient_init_conic(&paint->gradient, cx, cy, angle);
+	return &paint->gradient;
+}
+
 static inline struct cg_texture_t * cg_set_texture(struct cg_ctx_t *ctx, struct cg_surface_t * surface, enum cg_texture_type_t type)
 {
 	struct cg_paint_t * paint = &ctx->state->paint;
@@ -2300,6 +4570,11 @@ void cg_set_fill_rule(struct cg_ctx_t * ctx, enum cg_fill_rule_t winding)
 	ctx->state->winding = winding;
 }
 
+void cg_set_instance_quality(struct cg_ctx_t * ctx, enum cg_instance_quality_t quality)
+{
+	ctx->state->quality = quality;
+}
+
 void cg_set_line_width(struct cg_ctx_t * ctx, double width)
 {
 	ctx->state->stroke.width = width;
@@ -2349,6 +4624,7 @@ void cg_transform(struct cg_ctx_t * ctx, struct cg_matrix_t * m)
 void cg_set_matrix(struct cg_ctx_t * ctx, struct cg_matrix_t * m)
 {
 	memcpy(&ctx->state->matrix, m, sizeof(struct cg_matrix_t));
+	ctx->state->matrix.type = CG_MATRIX_TYPE_UNKNOWN;
 }
 
 void cg_identity_matrix(struct cg_ctx_t * ctx)
@@ -2401,6 +4677,16 @@ void cg_rectangle(struct cg_ctx_t * ctx, double x, double y, double w, double h)
 	cg_path_add_rectangle(ctx->path, x, y, w, h);
 }
 
+void cg_append_polyline(struct cg_ctx_t * ctx, const struct cg_point_t * points, int count, int close)
+{
+	cg_path_add_polyline(ctx->path, points, count, close);
+}
+
+void cg_append_polycurve(struct cg_ctx_t * ctx, const struct cg_point_t * points, int count, int close)
+{
+	cg_path_add_polycurve(ctx->path, points, count, close);
+}
+
 void cg_round_rectangle(struct cg_ctx_t * ctx, double x, double y, double w, double h, double rx, double ry)
 {
 	cg_path_add_round_rectangle(ctx->path, x, y, w, h, rx, ry);
@@ -2431,6 +4717,16 @@ void cg_new_path(struct cg_ctx_t * ctx)
 	cg_path_clear(ctx->path);
 }
 
+struct cg_path_t * cg_copy_path(struct cg_ctx_t * ctx)
+{
+	return cg_path_clone(ctx->path);
+}
+
+void cg_append_path(struct cg_ctx_t * ctx, const struct cg_path_t * path)
+{
+	cg_path_add_path(ctx->path, path);
+}
+
 void cg_close_path(struct cg_ctx_t * ctx)
 {
 	cg_path_close(ctx->path);
@@ -2450,18 +4746,7 @@ void cg_clip(struct cg_ctx_t * ctx)
 
 void cg_clip_preserve(struct cg_ctx_t * ctx)
 {
-	struct cg_state_t * state = ctx->state;
-	if(state->clippath)
-	{
-		cg_rle_clear(ctx->rle);
-		cg_rle_rasterize(ctx, ctx->rle, ctx->path, &state->matrix, &ctx->clip, NULL, state->winding);
-		cg_rle_clip_path(state->clippath, ctx->rle);
-	}
-	else
-	{
-		state->clippath = cg_rle_create();
-		cg_rle_rasterize(ctx, state->clippath, ctx->path, &state->matrix, &ctx->clip, NULL, state->winding);
-	}
+	cg_clip_path(ctx, ctx->path);
 }
 
 void cg_fill(struct cg_ctx_t * ctx)
@@ -2472,11 +4757,18 @@ void cg_fill(struct cg_ctx_t * ctx)
 
 void cg_fill_preserve(struct cg_ctx_t * ctx)
 {
-	struct cg_state_t * state = ctx->state;
-	cg_rle_clear(ctx->rle);
-	cg_rle_rasterize(ctx, ctx->rle, ctx->path, &state->matrix, &ctx->clip, NULL, state->winding);
-	cg_rle_clip_path(ctx->rle, state->clippath);
-	cg_blend(ctx, ctx->rle);
+	cg_fill_path(ctx, ctx->path);
+}
+
+void cg_fill_instances(struct cg_ctx_t * ctx, const struct cg_point_t * offsets, int count)
+{
+	cg_fill_instances_preserve(ctx, offsets, count);
+	cg_new_path(ctx);
+}
+
+void cg_fill_instances_preserve(struct cg_ctx_t * ctx, const struct cg_point_t * offsets, int count)
+{
+	cg_fill_instances_path(ctx, ctx->path, offsets, count);
 }
 
 void cg_stroke(struct cg_ctx_t * ctx)
@@ -2487,11 +4779,7 @@ void cg_stroke(struct cg_ctx_t * ctx)
 
 void cg_stroke_preserve(struct cg_ctx_t * ctx)
 {
-	struct cg_state_t * state = ctx->state;
-	cg_rle_clear(ctx->rle);
-	cg_rle_rasterize(ctx, ctx->rle, ctx->path, &state->matrix, &ctx->clip, &state->stroke, CG_FILL_RULE_NON_ZERO);
-	cg_rle_clip_path(ctx->rle, state->clippath);
-	cg_blend(ctx, ctx->rle);
+	cg_stroke_path(ctx, ctx->path);
 }
 
 void cg_paint(struct cg_ctx_t * ctx)
@@ -2510,3 +4798,638 @@ void cg_paint(struct cg_ctx_t * ctx)
 	struct cg_rle_t * rle = state->clippath ? state->clippath : ctx->clippath;
 	cg_blend(ctx, rle);
 }
+
+void cg_clip_path(struct cg_ctx_t * ctx, struct cg_path_t * path)
+{
+	struct cg_state_t * state = ctx->state;
+	if(state->clippath)
+	{
+		cg_rle_clear(ctx->rle);
+		cg_rle_rasterize(ctx, ctx->rle, path, &state->matrix, &ctx->clip, NULL, state->winding);
+		cg_rle_clip_path(state->clippath, ctx->rle);
+	}
+	else
+	{
+		state->clippath = cg_rle_create();
+		cg_rle_rasterize(ctx, state->clippath, path, &state->matrix, &ctx->clip, NULL, state->winding);
+	}
+}
+
+void cg_fill_path(struct cg_ctx_t * ctx, struct cg_path_t * path)
+{
+	struct cg_state_t * state = ctx->state;
+	cg_rle_clear(ctx->rle);
+	if(!cg_mask_cache_rasterize(ctx, ctx->rle, path, &state->matrix, NULL, state->winding))
+		cg_rle_rasterize(ctx, ctx->rle, path, &state->matrix, &ctx->clip, NULL, state->winding);
+	cg_rle_clip_path(ctx->rle, state->clippath);
+	cg_blend(ctx, ctx->rle);
+}
+
+void cg_stroke_path(struct cg_ctx_t * ctx, struct cg_path_t * path)
+{
+	struct cg_state_t * state = ctx->state;
+	cg_rle_clear(ctx->rle);
+	if(!cg_mask_cache_rasterize(ctx, ctx->rle, path, &state->matrix, &state->stroke, CG_FILL_RULE_NON_ZERO))
+		cg_rle_rasterize(ctx, ctx->rle, path, &state->matrix, &ctx->clip, &state->stroke, CG_FILL_RULE_NON_ZERO);
+	cg_rle_clip_path(ctx->rle, state->clippath);
+	cg_blend(ctx, ctx->rle);
+}
+
+/*
+ * Each offset is a translation in user space, so copies differ only by a device offset. That offset
+ * is rounded to the phase grid, the path is rasterized once for every phase in use and the cached
+ * spans are moved by the whole pixel part. Copies are blended in order in batches, which gives the
+ * same result as filling them one by one. Paths larger than the clip are rasterized for every copy.
+ */
+#define CG_INSTANCE_PHASES	(4)
+#define CG_INSTANCE_BATCH	(8192)
+
+void cg_fill_instances_path(struct cg_ctx_t * ctx, struct cg_path_t * path, const struct cg_point_t * offsets, int count)
+{
+	struct cg_state_t * state = ctx->state;
+	struct cg_matrix_t * m = &state->matrix;
+	struct cg_rle_t * phases[CG_INSTANCE_PHASES * CG_INSTANCE_PHASES] = { NULL };
+	struct cg_rle_t * batch = ctx->rle;
+	struct cg_rle_t * rle = NULL;
+	struct cg_rect_t * clip = &ctx->clip;
+	struct cg_rect_t e, r;
+	struct cg_matrix_t t;
+
+	if((count <= 0) || (path->bounds.x1 > path->bounds.x2))
+		return;
+	cg_path_extents(path, m, NULL, &e);
+	int n = (state->quality == CG_INSTANCE_QUALITY_GOOD) ? CG_INSTANCE_PHASES : 1;
+	int exact = (state->quality == CG_INSTANCE_QUALITY_BEST) || (e.w > clip->w) || (e.h > clip->h);
+
+	cg_rle_clear(batch);
+	for(int i = 0; i < count; i++)
+	{
+		double dx = m->a * offsets[i].x + m->c * offsets[i].y;
+		double dy = m->b * offsets[i].x + m->d * offsets[i].y;
+		if(!isfinite(dx) || !isfinite(dy))
+			continue;
+		if((e.x + dx >= clip->x + clip->w + 1) || (e.x + e.w + dx <= clip->x - 1) || (e.y + dy >= clip->y + clip->h + 1) || (e.y + e.h + dy <= clip->y - 1))
+			continue;
+
+		struct cg_rle_t * source;
+		int ix = 0, iy = 0;
+		if(exact)
+		{
+			if(!phases[0])
+				phases[0] = cg_rle_create();
+			source = phases[0];
+			t = *m;
+			t.tx += dx;
+			t.ty += dy;
+			t.type = CG_MATRIX_TYPE_UNKNOWN;
+			cg_rle_clear(source);
+			cg_rle_rasterize(ctx, source, path, &t, clip, NULL, state->winding);
+		}
+		else
+		{
+			double qx = floor(dx * n + 0.5);
+			double qy = floor(dy * n + 0.5);
+			double fx = floor(qx / n);
+			double fy = floor(qy / n);
+			int px = (int)(qx - fx * n);
+			int py = (int)(qy - fy * n);
+			source = phases[py * n + px];
+			if(!source)
+			{
+				source = phases[py * n + px] = cg_rle_create();
+				t = *m;
+				t.tx += (double)px / n;
+				t.ty += (double)py / n;
+				t.type = CG_MATRIX_TYPE_UNKNOWN;
+				r.x = floor(e.x) - 1;
+				r.y = floor(e.y) - 1;
+				r.w = ceil(e.x + e.w) + 2 - r.x;
+				r.h = ceil(e.y + e.h) + 2 - r.y;
+				cg_rle_rasterize(ctx, source, path, &t, &r, NULL, state->winding);
+			}
+			ix = (int)fx;
+			iy = (int)fy;
+		}
+
+		if(state->clippath)
+		{
+			if(!rle)
+				rle = cg_rle_create();
+			cg_rle_clear(rle);
+			cg_rle_append_translated(rle, source, ix, iy, clip);
+			cg_rle_clip_path(rle, state->clippath);
+			cg_rle_append_translated(batch, rle, 0, 0, clip);
+		}
+		else
+		{
+			cg_rle_append_translated(batch, source, ix, iy, clip);
+		}
+		if(batch->spans.size >= CG_INSTANCE_BATCH)
+		{
+			cg_rle_update_extents(batch);
+			cg_blend(ctx, batch);
+			cg_rle_clear(batch);
+		}
+	}
+	cg_rle_update_extents(batch);
+	cg_blend(ctx, batch);
+
+	for(int i = 0; i < CG_INSTANCE_PHASES * CG_INSTANCE_PHASES; i++)
+		cg_rle_destroy(phases[i]);
+	cg_rle_destroy(rle);
+}
+
+/*
+ * Extents are in device space. The plain queries map the path bounds, control points included, and
+ * pad strokes for the widest join or cap, so they never undershoot and cost no conversion. The tight
+ * queries convert (and stroke) the path and take the exact box of the resulting outline, curves
+ * bounded at their extrema. The _path variants query a retained path, whose outline is cached.
+ */
+void cg_fill_extents(struct cg_ctx_t * ctx, struct cg_rect_t * extents)
+{
+	cg_path_extents(ctx->path, &ctx->state->matrix, NULL, extents);
+}
+
+void cg_stroke_extents(struct cg_ctx_t * ctx, struct cg_rect_t * extents)
+{
+	cg_path_extents(ctx->path, &ctx->state->matrix, &ctx->state->stroke, extents);
+}
+
+static void cg_path_extents_tight(struct cg_ctx_t * ctx, struct cg_path_t * path, struct cg_stroke_data_t * stroke, struct cg_rect_t * extents)
+{
+	XCG_FT_Outline outline;
+	XCG_FT_BBox bbox;
+	struct cg_rect_t e;
+
+	cg_path_extents(path, &ctx->state->matrix, stroke, &e);
+	if((e.w <= 0) && (e.h <= 0))
+	{
+		*extents = e;
+		return;
+	}
+	cg_path_outline(ctx, path, &ctx->state->matrix, stroke, &outline);
+	XCG_FT_Outline_Get_BBox(&outline, &bbox);
+	extents->x = bbox.xMin / 64.0;
+	extents->y = bbox.yMin / 64.0;
+	extents->w = (bbox.xMax - bbox.xMin) / 64.0;
+	extents->h = (bbox.yMax - bbox.yMin) / 64.0;
+}
+
+void cg_fill_extents_tight(struct cg_ctx_t * ctx, struct cg_rect_t * extents)
+{
+	cg_path_extents_tight(ctx, ctx->path, NULL, extents);
+}
+
+void cg_stroke_extents_tight(struct cg_ctx_t * ctx, struct cg_rect_t * extents)
+{
+	cg_path_extents_tight(ctx, ctx->path, &ctx->state->stroke, extents);
+}
+
+void cg_fill_extents_path(struct cg_ctx_t * ctx, struct cg_path_t * path, struct cg_rect_t * extents)
+{
+	cg_path_extents(path, &ctx->state->matrix, NULL, extents);
+}
+
+void cg_stroke_extents_path(struct cg_ctx_t * ctx, struct cg_path_t * path, struct cg_rect_t * extents)
+{
+	cg_path_extents(path, &ctx->state->matrix, &ctx->state->stroke, extents);
+}
+
+void cg_fill_extents_tight_path(struct cg_ctx_t * ctx, struct cg_path_t * path, struct cg_rect_t * extents)
+{
+	cg_path_extents_tight(ctx, path, NULL, extents);
+}
+
+void cg_stroke_extents_tight_path(struct cg_ctx_t * ctx, struct cg_path_t * path, struct cg_rect_t * extents)
+{
+	cg_path_extents_tight(ctx, path, &ctx->state->stroke, extents);
+}
+
+/*
+ * Hit testing walks the path in device space, flattening curves on the fly, so nothing is allocated
+ * or rasterized. Fills count the winding number of a ray cast towards +x. Strokes test the distance
+ * to each segment against half the stroker's width, with joins and caps shaped as the stroker does.
+ */
+struct cg_hit_test_t {
+	double x, y;
+	double hw;
+	double miterlimit;
+	enum cg_line_cap_t cap;
+	enum cg_line_join_t join;
+	int stroke;
+	int winding;
+	int inside;
+	double sx, sy;
+	double cx, cy;
+	double fdx, fdy;
+	double ldx, ldy;
+	int segments;
+};
+
+static inline int hit_test_triangle(double x, double y, double x0, double y0, double x1, double y1, double x2, double y2)
+{
+	double c0 = (x1 - x0) * (y - y0) - (y1 - y0) * (x - x0);
+	double c1 = (x2 - x1) * (y - y1) - (y2 - y1) * (x - x1);
+	double c2 = (x0 - x2) * (y - y2) - (y0 - y2) * (x - x2);
+	return ((c0 >= 0) && (c1 >= 0) && (c2 >= 0)) || ((c0 <= 0) && (c1 <= 0) && (c2 <= 0));
+}
+
+static inline void hit_test_vertex(struct cg_hit_test_t * h, double x, double y)
+{
+	double dx = h->x - x;
+	double dy = h->y - y;
+	if(dx * dx + dy * dy <= h->hw * h->hw)
+		h->inside = 1;
+}
+
+/*
+ * The sector of a round join, between the end of the piece coming in along (dx0, dy0) and the
+ * start of the one going out along (dx1, dy1), so that it does not reach past short pieces
+ */
+static inline void hit_test_round(struct cg_hit_test_t * h, double x, double y, double dx0, double dy0, double dx1, double dy1)
+{
+	double px = h->x - x;
+	double py = h->y - y;
+	if((px * dx0 + py * dy0 >= 0.0) && (px * dx1 + py * dy1 <= 0.0))
+		hit_test_vertex(h, x, y);
+}
+
+/*
+ * The outer wedge between two segments meeting at (x, y): round, bevelled, or mitred while
+ * the miter stays within the limit, as XCG_FT_STROKER_LINEJOIN_MITER_FIXED does
+ */
+static inline void hit_test_join(struct cg_hit_test_t * h, double x, double y, double dx0, double dy0, double dx1, double dy1)
+{
+	if(h->join == CG_LINE_JOIN_ROUND)
+	{
+		hit_test_round(h, x, y, dx0, dy0, dx1, dy1);
+		return;
+	}
+	double l0 = sqrt(dx0 * dx0 + dy0 * dy0);
+	double l1 = sqrt(dx1 * dx1 + dy1 * dy1);
+	dx0 /= l0; dy0 /= l0;
+	dx1 /= l1; dy1 /= l1;
+	double cross = dx0 * dy1 - dy0 * dx1;
+	if(cross == 0.0)
+		return;
+	double side = cross > 0.0 ? h->hw : -h->hw;
+	double ax = x + dy0 * side, ay = y - dx0 * side;
+	double bx = x + dy1 * side, by = y - dx1 * side;
+	if(h->join == CG_LINE_JOIN_MITER)
+	{
+		double c = sqrt((1.0 + dx0 * dx1 + dy0 * dy1) * 0.5);
+		if(h->miterlimit * c >= 1.0)
+		{
+			double mx = ax + bx - 2 * x, my = ay + by - 2 * y;
+			double ml = sqrt(mx * mx + my * my);
+			double tx = x + mx / ml * h->hw / c;
+			double ty = y + my / ml * h->hw / c;
+			if(hit_test_triangle(h->x, h->y, x, y, ax, ay, tx, ty) || hit_test_triangle(h->x, h->y, x, y, tx, ty, bx, by))
+				h->inside = 1;
+			return;
+		}
+	}
+	if(hit_test_triangle(h->x, h->y, x, y, ax, ay, bx, by))
+		h->inside = 1;
+}
+
+static inline void hit_test_cap(struct cg_hit_test_t * h, double x, double y, double dx, double dy)
+{
+	double l = sqrt(dx * dx + dy * dy);
+	double u = ((h->x - x) * dx + (h->y - y) * dy) / l;
+	double v = ((h->y - y) * dx - (h->x - x) * dy) / l;
+	switch(h->cap)
+	{
+	case CG_LINE_CAP_ROUND:
+		if(u >= 0.0)
+			hit_test_vertex(h, x, y);
+		break;
+	case CG_LINE_CAP_SQUARE:
+		if((u >= 0.0) && (u <= h->hw) && (fabs(v) <= h->hw))
+			h->inside = 1;
+		break;
+	default:
+		break;
+	}
+}
+
+/*
+ * A straight piece of stroke from the current point, ending square to (ax0, ay0) at its start
+ * and to (ax1, ay1) at its end: to itself for a line, to the tangents at the ends of a curve
+ */
+static inline void hit_test_step(struct cg_hit_test_t * h, double x, double y, double ax0, double ay0, double ax1, double ay1)
+{
+	double x0 = h->cx, y0 = h->cy;
+	double dx = x - x0, dy = y - y0;
+	double l2 = dx * dx + dy * dy;
+	double px = h->x - x0, py = h->y - y0;
+	double c = px * dy - py * dx;
+	if((px * ax0 + py * ay0 >= 0.0) && ((h->x - x) * ax1 + (h->y - y) * ay1 <= 0.0) && (c * c <= h->hw * h->hw * l2))
+		h->inside = 1;
+	h->cx = x;
+	h->cy = y;
+}
+
+/*
+ * A straight piece from the current point, a whole line or one step of a flattened curve
+ */
+static inline void hit_test_segment(struct cg_hit_test_t * h, double x, double y)
+{
+	double x0 = h->cx, y0 = h->cy;
+	double dx = x - x0, dy = y - y0;
+
+	if(h->stroke)
+	{
+		hit_test_step(h, x, y, dx, dy, dx, dy);
+	}
+	else
+	{
+		double c = dx * (h->y - y0) - (h->x - x0) * dy;
+		if(y0 <= h->y)
+		{
+			if((y > h->y) && (c > 0.0))
+				h->winding += 1;
+		}
+		else
+		{
+			if((y <= h->y) && (c < 0.0))
+				h->winding -= 1;
+		}
+		h->cx = x;
+		h->cy = y;
+	}
+}
+
+/*
+ * Joins and caps hang off the tangents entering and leaving each element
+ */
+static inline void hit_test_enter(struct cg_hit_test_t * h, double dx, double dy)
+{
+	if(h->segments > 0)
+		hit_test_join(h, h->cx, h->cy, h->ldx, h->ldy, dx, dy);
+	else
+	{
+		h->fdx = dx;
+		h->fdy = dy;
+	}
+}
+
+static inline void hit_test_leave(struct cg_hit_test_t * h, double dx, double dy)
+{
+	h->ldx = dx;
+	h->ldy = dy;
+	h->segments += 1;
+}
+
+static inline void hit_test_line(struct cg_hit_test_t * h, double x, double y)
+{
+	double dx = x - h->cx;
+	double dy = y - h->cy;
+	if(h->stroke)
+	{
+		if((dx == 0.0) && (dy == 0.0))
+			return;
+		hit_test_enter(h, dx, dy);
+		hit_test_segment(h, x, y);
+		hit_test_leave(h, dx, dy);
+	}
+	else
+	{
+		hit_test_segment(h, x, y);
+	}
+}
+
+/*
+ * Curves whose control box, padded by the half width for strokes, cannot reach the point
+ * (or lies left of it for fills) are stepped over without being flattened. Between the steps
+ * of a flattened curve the stroke is smooth, so the steps meet with round joins, and the first
+ * and last steps end square to the tangents, as the offset curves do, rather than to themselves.
+ */
+static inline void hit_test_curve(struct cg_hit_test_t * h, const struct cg_point_t * p)
+{
+	double x1 = CG_MIN(CG_MIN(p[0].x, p[1].x), CG_MIN(p[2].x, p[3].x));
+	double y1 = CG_MIN(CG_MIN(p[0].y, p[1].y), CG_MIN(p[2].y, p[3].y));
+	double x2 = CG_MAX(CG_MAX(p[0].x, p[1].x), CG_MAX(p[2].x, p[3].x));
+	double y2 = CG_MAX(CG_MAX(p[0].y, p[1].y), CG_MAX(p[2].y, p[3].y));
+	double sdx = 0, sdy = 0, edx = 0, edy = 0;
+	int skip;
+
+	if(h->stroke)
+	{
+		if((x1 == x2) && (y1 == y2))
+			return;
+		for(int j = 1; (j < 4) && (sdx == 0.0) && (sdy == 0.0); j++)
+		{
+			sdx = p[j].x - p[0].x;
+			sdy = p[j].y - p[0].y;
+		}
+		for(int j = 2; (j >= 0) && (edx == 0.0) && (edy == 0.0); j--)
+		{
+			edx = p[3].x - p[j].x;
+			edy = p[3].y - p[j].y;
+		}
+		hit_test_enter(h, sdx, sdy);
+		skip = (h->x < x1 - h->hw) || (h->x > x2 + h->hw) || (h->y < y1 - h->hw) || (h->y > y2 + h->hw);
+	}
+	else
+	{
+		skip = (h->x > x2) || (h->y < y1) || (h->y > y2);
+	}
+	if(skip)
+	{
+		h->cx = p[3].x;
+		h->cy = p[3].y;
+	}
+	else
+	{
+		int n = cubic_segments(&p[0], &p[1], &p[2], &p[3]);
+		double dt = 1.0 / n;
+		double ldx = 0, ldy = 0;
+		for(int i = 1; i <= n; i++)
+		{
+			double x = p[3].x, y = p[3].y;
+			if(i < n)
+			{
+				double t = i * dt;
+				double s = 1.0 - t;
+				double a = s * s * s, b = 3 * s * s * t, c = 3 * s * t * t, d = t * t * t;
+				x = a * p[0].x + b * p[1].x + c * p[2].x + d * p[3].x;
+				y = a * p[0].y + b * p[1].y + c * p[2].y + d * p[3].y;
+			}
+			if(h->stroke)
+			{
+				double dx = x - h->cx, dy = y - h->cy;
+				if((dx == 0.0) && (dy == 0.0))
+					continue;
+				double ax0 = dx, ay0 = dy, ax1 = dx, ay1 = dy;
+				if((i == 1) && (sdx * dx + sdy * dy > 0.0))
+				{
+					ax0 = sdx;
+					ay0 = sdy;
+				}
+				if((i == n) && (edx * dx + edy * dy > 0.0))
+				{
+					ax1 = edx;
+					ay1 = edy;
+				}
+				if((ldx != 0.0) || (ldy != 0.0))
+					hit_test_round(h, h->cx, h->cy, ldx, ldy, ax0, ay0);
+				hit_test_step(h, x, y, ax0, ay0, ax1, ay1);
+				ldx = ax1;
+				ldy = ay1;
+			}
+			else
+			{
+				hit_test_segment(h, x, y);
+			}
+		}
+		h->cx = p[3].x;
+		h->cy = p[3].y;
+	}
+	if(h->stroke)
+		hit_test_leave(h, edx, edy);
+}
+
+static inline void hit_test_begin(struct cg_hit_test_t * h, double x, double y)
+{
+	h->sx = h->cx = x;
+	h->sy = h->cy = y;
+	h->segments = 0;
+}
+
+static inline void hit_test_end(struct cg_hit_test_t * h, int closed)
+{
+	if(h->stroke)
+	{
+		if(h->segments == 0)
+			return;
+		if(closed)
+		{
+			hit_test_join(h, h->sx, h->sy, h->ldx, h->ldy, h->fdx, h->fdy);
+		}
+		else
+		{
+			hit_test_cap(h, h->sx, h->sy, -h->fdx, -h->fdy);
+			hit_test_cap(h, h->cx, h->cy, h->ldx, h->ldy);
+		}
+	}
+	else if((h->cx != h->sx) || (h->cy != h->sy))
+	{
+		hit_test_segment(h, h->sx, h->sy);
+	}
+}
+
+static int cg_path_hit_test(struct cg_path_t * path, struct cg_matrix_t * m, struct cg_stroke_data_t * stroke, enum cg_fill_rule_t winding, double x, double y)
+{
+	struct cg_hit_test_t h;
+	struct cg_point_t p[4];
+	struct cg_point_t r[2];
+	struct cg_point_t q;
+	struct cg_rect_t e;
+
+	p[0].x = x;
+	p[0].y = y;
+	cg_matrix_map_point(m, &p[0], &q);
+	cg_path_extents(path, m, stroke, &e);
+	if((path->elements.size == 0) || (q.x < e.x) || (q.x > e.x + e.w) || (q.y < e.y) || (q.y > e.y + e.h))
+		return 0;
+
+	memset(&h, 0, sizeof(struct cg_hit_test_t));
+	h.x = q.x;
+	h.y = q.y;
+	if(stroke)
+	{
+		h.stroke = 1;
+		h.hw = fabs(stroke->width) * 0.5 * cg_matrix_stroke_scale(m);
+		h.miterlimit = stroke->miterlimit;
+		h.cap = stroke->cap;
+		h.join = stroke->join;
+	}
+
+	struct cg_path_point_t * points = path->points.data;
+	for(int i = 0; i < path->elements.size; i++)
+	{
+		switch(path->elements.data[i])
+		{
+		case CG_PATH_ELEMENT_MOVE_TO:
+			if(i > 0)
+				hit_test_end(&h, 0);
+			p[0].x = points[0].x;
+			p[0].y = points[0].y;
+			cg_matrix_map_point(m, &p[0], &q);
+			hit_test_begin(&h, q.x, q.y);
+			points += 1;
+			break;
+		case CG_PATH_ELEMENT_LINE_TO:
+			p[0].x = points[0].x;
+			p[0].y = points[0].y;
+			cg_matrix_map_point(m, &p[0], &q);
+			hit_test_line(&h, q.x, q.y);
+			points += 1;
+			break;
+		case CG_PATH_ELEMENT_CURVE_TO:
+			p[0].x = h.cx;
+			p[0].y = h.cy;
+			for(int j = 0; j < 3; j++)
+			{
+				q.x = points[j].x;
+				q.y = points[j].y;
+				cg_matrix_map_point(m, &q, &p[j + 1]);
+			}
+			hit_test_curve(&h, p);
+			points += 3;
+			break;
+		case CG_PATH_ELEMENT_QUAD_TO:
+			p[0].x = h.cx;
+			p[0].y = h.cy;
+			for(int j = 0; j < 2; j++)
+			{
+				q.x = points[j].x;
+				q.y = points[j].y;
+				cg_matrix_map_point(m, &q, &r[j]);
+			}
+			quad_to_cubic(p, r);
+			hit_test_curve(&h, p);
+			points += 2;
+			break;
+		case CG_PATH_ELEMENT_CLOSE:
+			hit_test_line(&h, h.sx, h.sy);
+			hit_test_end(&h, 1);
+			hit_test_begin(&h, h.sx, h.sy);
+			points += 1;
+			break;
+		default:
+			break;
+		}
+		if(h.inside)
+			return 1;
+	}
+	hit_test_end(&h, 0);
+	if(h.stroke)
+		return h.inside;
+	if(winding == CG_FILL_RULE_EVEN_ODD)
+		return h.winding & 1;
+	return h.winding != 0;
+}
+
+int cg_in_fill(struct cg_ctx_t * ctx, double x, double y)
+{
+	struct cg_state_t * state = ctx->state;
+	return cg_path_hit_test(ctx->path, &state->matrix, NULL, state->winding, x, y);
+}
+
+/*
+ * Dashed strokes are tested against the dashed path, which is the only case that allocates
+ */
+int cg_in_stroke(struct cg_ctx_t * ctx, double x, double y)
+{
+	struct cg_state_t * state = ctx->state;
+	if(state->stroke.dash)
+	{
+		struct cg_path_t * dashed = cg_dash_path(state->stroke.dash, cg_path_measure(ctx->path));
+		int inside = cg_path_hit_test(dashed, &state->matrix, &state->stroke, CG_FILL_RULE_NON_ZERO, x, y);
+		cg_path_destroy(dashed);
+		return inside;
+	}
+	return cg_path_hit_test(ctx->path, &state->matrix, &state->stroke, CG_FILL_RULE_NON_ZERO, x, y);
+}
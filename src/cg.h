@@ -19,10 +19,25 @@ struct cg_rect_t {
 	double h;
 };
 
+/*
+ * The type is worked out on demand and kept up to date by the cg_matrix_* functions,
+ * after changing the coefficients directly set it back to CG_MATRIX_TYPE_UNKNOWN.
+ */
+enum cg_matrix_type_t {
+	CG_MATRIX_TYPE_UNKNOWN			= 0,
+	CG_MATRIX_TYPE_IDENTITY			= 1,
+	CG_MATRIX_TYPE_INTEGER_TRANSLATE	= 2,
+	CG_MATRIX_TYPE_TRANSLATE		= 3,
+	CG_MATRIX_TYPE_SCALE			= 4, /* b = c = 0 */
+	CG_MATRIX_TYPE_AXIS_ALIGNED		= 5, /* a = d = 0 */
+	CG_MATRIX_TYPE_AFFINE			= 6,
+};
+
 struct cg_matrix_t {
 	double a; double b;
 	double c; double d;
 	double tx; double ty;
+	enum cg_matrix_type_t type;
 };
 
 struct cg_color_t {
@@ -42,6 +57,25 @@ enum cg_path_element_t {
 	CG_PATH_ELEMENT_LINE_TO		= 1,
 	CG_PATH_ELEMENT_CURVE_TO	= 2,
 	CG_PATH_ELEMENT_CLOSE		= 3,
+	CG_PATH_ELEMENT_QUAD_TO		= 4,
+};
+
+/*
+ * Building with CG_PATH_SINGLE_PRECISION stores path points as float and element codes as
+ * bytes, which halves the memory used by large paths. It must be defined for both the library
+ * and its users, as it changes the layout of struct cg_path_t.
+ */
+#ifdef CG_PATH_SINGLE_PRECISION
+typedef float cg_path_real_t;
+typedef uint8_t cg_path_code_t;
+#else
+typedef double cg_path_real_t;
+typedef enum cg_path_element_t cg_path_code_t;
+#endif
+
+struct cg_path_point_t {
+	cg_path_real_t x;
+	cg_path_real_t y;
 };
 
 enum cg_spread_method_t {
@@ -53,6 +87,7 @@ enum cg_spread_method_t {
 enum cg_gradient_type_t {
 	CG_GRADIENT_TYPE_LINEAR		= 0,
 	CG_GRADIENT_TYPE_RADIAL		= 1,
+	CG_GRADIENT_TYPE_CONIC		= 2,
 };
 
 enum cg_texture_type_t {
@@ -60,6 +95,12 @@ enum cg_texture_type_t {
 	CG_TEXTURE_TYPE_TILED		= 1,
 };
 
+enum cg_texture_filter_t {
+	CG_TEXTURE_FILTER_NEAREST	= 0,
+	CG_TEXTURE_FILTER_BILINEAR	= 1,
+	CG_TEXTURE_FILTER_MIPMAP	= 2,
+};
+
 enum cg_line_cap_t {
 	CG_LINE_CAP_BUTT			= 0,
 	CG_LINE_CAP_ROUND			= 1,
@@ -90,6 +131,16 @@ enum cg_operator_t {
 	CG_OPERATOR_DST_OUT			= 3, /* r = d * sia * ca + d * cia */
 };
 
+/*
+ * How cg_fill_instances places copies: FAST snaps each one to whole device pixels, GOOD rounds
+ * to a quarter pixel on each axis (sixteen cached rasterizations), BEST rasterizes every copy.
+ */
+enum cg_instance_quality_t {
+	CG_INSTANCE_QUALITY_FAST	= 0,
+	CG_INSTANCE_QUALITY_GOOD	= 1,
+	CG_INSTANCE_QUALITY_BEST	= 2,
+};
+
 struct cg_surface_t {
 	int ref;
 	int width;
@@ -97,21 +148,52 @@ struct cg_surface_t {
 	int stride;
 	int owndata;
 	void * pixels;
+	int tracked;
+	int opaque;
+	struct cg_surface_t * mipmap;
 };
 
+struct cg_path_measure_t;
+struct cg_outline_cache_t;
+
 struct cg_path_t {
 	int contours;
+	unsigned int serial;
 	struct cg_point_t start;
 	struct {
-		enum cg_path_element_t * data;
+		cg_path_code_t * data;
 		int size;
 		int capacity;
 	} elements;
 	struct {
-		struct cg_point_t * data;
+		struct cg_path_point_t * data;
 		int size;
 		int capacity;
 	} points;
+	struct {
+		double x1; double y1;
+		double x2; double y2;
+	} bounds; /* Box of all points including control points, x1 > x2 when empty */
+	struct {
+		unsigned int serial;
+		double x; double y;
+		double w; double h;
+		double rx; double ry;
+	} shape; /* The rounded rectangle (or ellipse) that is all of the path while serial matches */
+	struct cg_path_measure_t * measure;
+	struct cg_outline_cache_t * fill;
+	struct cg_outline_cache_t * stroke;
+};
+
+struct cg_path_measure_t {
+	unsigned int serial;
+	struct cg_path_t * source;
+	struct cg_path_t * flat;
+	struct {
+		double * data;
+		int size;
+		int capacity;
+	} lengths;
 };
 
 struct cg_gradient_t {
@@ -120,6 +202,7 @@ struct cg_gradient_t {
 	struct cg_matrix_t matrix;
 	double values[6];
 	double opacity;
+	int dither;
 	struct {
 		struct cg_gradient_stop_t * data;
 		int size;
@@ -129,6 +212,7 @@ struct cg_gradient_t {
 
 struct cg_texture_t {
 	enum cg_texture_type_t type;
+	enum cg_texture_filter_t filter;
 	struct cg_surface_t * surface;
 	struct cg_matrix_t matrix;
 	double opacity;
@@ -174,6 +258,47 @@ struct cg_stroke_data_t {
 	struct cg_dash_t * dash;
 };
 
+struct cg_outline_cache_t {
+	unsigned int serial;
+	struct cg_matrix_t matrix;
+	struct cg_stroke_data_t stroke;
+	XCG_FT_Outline outline;
+	void * data;
+	size_t size;
+};
+
+/*
+ * An entry keeps the coverage of a path for one matrix with the integer part of the translation
+ * taken out, spans are relative to that whole pixel origin. Paths are matched by a hash of their
+ * elements and points, so rebuilding the same icon every frame still hits.
+ */
+struct cg_mask_t {
+	struct cg_mask_t * chain;
+	struct cg_mask_t * prev;
+	struct cg_mask_t * next;
+	uint64_t hash;
+	int nelement;
+	int npoint;
+	cg_path_code_t * elements;
+	struct cg_path_point_t * points;
+	struct cg_matrix_t matrix;
+	struct cg_stroke_data_t stroke;
+	int stroked;
+	enum cg_fill_rule_t winding;
+	struct cg_rle_t rle;
+	size_t size;
+};
+
+struct cg_mask_cache_t {
+	struct cg_mask_t ** buckets;
+	struct cg_mask_t * head; /* Most recently used */
+	struct cg_mask_t * tail;
+	size_t size;
+	size_t budget;
+	unsigned long hits;
+	unsigned long misses;
+};
+
 struct cg_state_t {
 	struct cg_rle_t * clippath;
 	struct cg_paint_t paint;
@@ -182,6 +307,7 @@ struct cg_state_t {
 	struct cg_stroke_data_t stroke;
 	enum cg_operator_t op;
 	double opacity;
+	enum cg_instance_quality_t quality;
 	struct cg_state_t * next;
 };
 
@@ -194,6 +320,7 @@ struct cg_ctx_t {
 	struct cg_rect_t clip;
 	void * outline_data;
 	size_t outline_size;
+	struct cg_mask_cache_t masks;
 };
 
 #ifndef CG_MIN
@@ -224,6 +351,10 @@ void cg_comp_source(uint32_t * dst, int len, uint32_t * src, uint32_t alpha);
 void cg_comp_source_over(uint32_t * dst, int len, uint32_t * src, uint32_t alpha);
 void cg_comp_destination_in(uint32_t * dst, int len, uint32_t * src, uint32_t alpha);
 void cg_comp_destination_out(uint32_t * dst, int len, uint32_t * src, uint32_t alpha);
+void cg_fetch_linear_pad(uint32_t * dst, int len, const uint32_t * colortable, int size, int t, int inc);
+void cg_fetch_linear_reflect(uint32_t * dst, int len, const uint32_t * colortable, int size, int t, int inc);
+void cg_fetch_linear_repeat(uint32_t * dst, int len, const uint32_t * colortable, int size, int t, int inc);
+void cg_matrix_map_points_fixed(XCG_FT_Vector * dst, const struct cg_path_point_t * src, int count, struct cg_matrix_t * m);
 
 void cg_matrix_init(struct cg_matrix_t * m, double a, double b, double c, double d, double tx, double ty);
 void cg_matrix_init_identity(struct cg_matrix_t * m);
@@ -236,17 +367,43 @@ void cg_matrix_rotate(struct cg_matrix_t * m, double r);
 void cg_matrix_multiply(struct cg_matrix_t * m, struct cg_matrix_t * m1, struct cg_matrix_t * m2);
 void cg_matrix_invert(struct cg_matrix_t * m);
 void cg_matrix_map_point(struct cg_matrix_t * m, struct cg_point_t * p1, struct cg_point_t * p2);
+enum cg_matrix_type_t cg_matrix_get_type(struct cg_matrix_t * m);
 
 struct cg_surface_t * cg_surface_create(int width, int height);
 struct cg_surface_t * cg_surface_create_for_data(int width, int height, void * pixels);
 void cg_surface_destroy(struct cg_surface_t * surface);
 struct cg_surface_t * cg_surface_reference(struct cg_surface_t * surface);
+void cg_surface_set_tracked(struct cg_surface_t * surface, int tracked);
+void cg_surface_mark_dirty(struct cg_surface_t * surface);
+
+struct cg_path_t * cg_path_create(void);
+void cg_path_destroy(struct cg_path_t * path);
+struct cg_path_t * cg_path_clone(const struct cg_path_t * path);
+void cg_path_move_to(struct cg_path_t * path, double x, double y);
+void cg_path_line_to(struct cg_path_t * path, double x, double y);
+void cg_path_curve_to(struct cg_path_t * path, double x1, double y1, double x2, double y2, double x3, double y3);
+void cg_path_quad_to(struct cg_path_t * path, double x1, double y1, double x2, double y2);
+void cg_path_rel_move_to(struct cg_path_t * path, double dx, double dy);
+void cg_path_rel_line_to(struct cg_path_t * path, double dx, double dy);
+void cg_path_rel_curve_to(struct cg_path_t * path, double dx1, double dy1, double dx2, double dy2, double dx3, double dy3);
+void cg_path_rel_quad_to(struct cg_path_t * path, double dx1, double dy1, double dx2, double dy2);
+void cg_path_add_rectangle(struct cg_path_t * path, double x, double y, double w, double h);
+void cg_path_add_polyline(struct cg_path_t * path, const struct cg_point_t * points, int count, int close);
+void cg_path_add_polycurve(struct cg_path_t * path, const struct cg_point_t * points, int count, int close);
+void cg_path_add_round_rectangle(struct cg_path_t * path, double x, double y, double w, double h, double rx, double ry);
+void cg_path_add_ellipse(struct cg_path_t * path, double cx, double cy, double rx, double ry);
+void cg_path_add_arc(struct cg_path_t * path, double cx, double cy, double r, double a0, double a1, int ccw);
+void cg_path_add_path(struct cg_path_t * path, const struct cg_path_t * source);
+void cg_path_close(struct cg_path_t * path);
+void cg_path_clear(struct cg_path_t * path);
 
 void cg_gradient_set_values_linear(struct cg_gradient_t * gradient, double x1, double y1, double x2, double y2);
 void cg_gradient_set_values_radial(struct cg_gradient_t * gradient, double cx, double cy, double cr, double fx, double fy, double fr);
+void cg_gradient_set_values_conic(struct cg_gradient_t * gradient, double cx, double cy, double angle);
 void cg_gradient_set_spread(struct cg_gradient_t * gradient, enum cg_spread_method_t spread);
 void cg_gradient_set_matrix(struct cg_gradient_t * gradient, struct cg_matrix_t * m);
 void cg_gradient_set_opacity(struct cg_gradient_t * gradient, double opacity);
+void cg_gradient_set_dither(struct cg_gradient_t * gradient, int dither);
 void cg_gradient_add_stop_rgb(struct cg_gradient_t * gradient, double offset, double r, double g, double b);
 void cg_gradient_add_stop_rgba(struct cg_gradient_t * gradient, double offset, double r, double g, double b, double a);
 void cg_gradient_add_stop_color(struct cg_gradient_t * gradient, double offset, struct cg_color_t * color);
@@ -254,12 +411,16 @@ void cg_gradient_add_stop(struct cg_gradient_t * gradient, struct cg_gradient_st
 void cg_gradient_clear_stops(struct cg_gradient_t * gradient);
 
 void cg_texture_set_type(struct cg_texture_t * texture, enum cg_texture_type_t type);
+void cg_texture_set_filter(struct cg_texture_t * texture, enum cg_texture_filter_t filter);
 void cg_texture_set_matrix(struct cg_texture_t * texture, struct cg_matrix_t * m);
 void cg_texture_set_surface(struct cg_texture_t * texture, struct cg_surface_t * surface);
 void cg_texture_set_opacity(struct cg_texture_t * texture, double opacity);
 
 struct cg_ctx_t * cg_create(struct cg_surface_t * surface);
 void cg_destroy(struct cg_ctx_t * ctx);
+void cg_mask_cache_set_budget(struct cg_ctx_t * ctx, size_t bytes);
+void cg_mask_cache_clear(struct cg_ctx_t * ctx);
+void cg_mask_cache_stats(struct cg_ctx_t * ctx, unsigned long * hits, unsigned long * misses, size_t * size);
 void cg_save(struct cg_ctx_t * ctx);
 void cg_restore(struct cg_ctx_t * ctx);
 struct cg_color_t * cg_set_source_rgb(struct cg_ctx_t * ctx, double r, double g, double b);
@@ -267,10 +428,12 @@ struct cg_color_t * cg_set_source_rgba(struct cg_ctx_t * ctx, double r, double g
 struct cg_color_t * cg_set_source_color(struct cg_ctx_t * ctx, struct cg_color_t * color);
 struct cg_gradient_t * cg_set_source_linear_gradient(struct cg_ctx_t * ctx, double x1, double y1, double x2, double y2);
 struct cg_gradient_t * cg_set_source_radial_gradient(struct cg_ctx_t * ctx, double cx, double cy, double cr, double fx, double fy, double fr);
+struct cg_gradient_t * cg_set_source_conic_gradient(struct cg_ctx_t * ctx, double cx, double cy, double angle);
 struct cg_texture_t * cg_set_source_surface(struct cg_ctx_t * ctx, struct cg_surface_t * surface, double x, double y);
 void cg_set_operator(struct cg_ctx_t * ctx, enum cg_operator_t op);
 void cg_set_opacity(struct cg_ctx_t * ctx, double opacity);
 void cg_set_fill_rule(struct cg_ctx_t * ctx, enum cg_fill_rule_t winding);
+void cg_set_instance_quality(struct cg_ctx_t * ctx, enum cg_instance_quality_t quality);
 void cg_set_line_width(struct cg_ctx_t * ctx, double width);
 void cg_set_line_cap(struct cg_ctx_t * ctx, enum cg_line_cap_t cap);
 void cg_set_line_join(struct cg_ctx_t * ctx, enum cg_line_join_t join);
@@ -291,21 +454,41 @@ void cg_rel_line_to(struct cg_ctx_t * ctx, double dx, double dy);
 void cg_rel_curve_to(struct cg_ctx_t * ctx, double dx1, double dy1, double dx2, double dy2, double dx3, double dy3);
 void cg_rel_quad_to(struct cg_ctx_t * ctx, double dx1, double dy1, double dx2, double dy2);
 void cg_rectangle(struct cg_ctx_t * ctx, double x, double y, double w, double h);
+void cg_append_polyline(struct cg_ctx_t * ctx, const struct cg_point_t * points, int count, int close);
+void cg_append_polycurve(struct cg_ctx_t * ctx, const struct cg_point_t * points, int count, int close);
 void cg_round_rectangle(struct cg_ctx_t * ctx, double x, double y, double w, double h, double rx, double ry);
 void cg_ellipse(struct cg_ctx_t * ctx, double cx, double cy, double rx, double ry);
 void cg_circle(struct cg_ctx_t * ctx, double cx, double cy, double r);
 void cg_arc(struct cg_ctx_t * ctx, double cx, double cy, double r, double a0, double a1);
 void cg_arc_negative(struct cg_ctx_t * ctx, double cx, double cy, double r, double a0, double a1);
 void cg_new_path(struct cg_ctx_t * ctx);
+struct cg_path_t * cg_copy_path(struct cg_ctx_t * ctx);
+void cg_append_path(struct cg_ctx_t * ctx, const struct cg_path_t * path);
 void cg_close_path(struct cg_ctx_t * ctx);
 void cg_reset_clip(struct cg_ctx_t * ctx);
 void cg_clip(struct cg_ctx_t * ctx);
 void cg_clip_preserve(struct cg_ctx_t * ctx);
 void cg_fill(struct cg_ctx_t * ctx);
 void cg_fill_preserve(struct cg_ctx_t * ctx);
+void cg_fill_instances(struct cg_ctx_t * ctx, const struct cg_point_t * offsets, int count);
+void cg_fill_instances_preserve(struct cg_ctx_t * ctx, const struct cg_point_t * offsets, int count);
 void cg_stroke(struct cg_ctx_t * ctx);
 void cg_stroke_preserve(struct cg_ctx_t * ctx);
 void cg_paint(struct cg_ctx_t * ctx);
+void cg_clip_path(struct cg_ctx_t * ctx, struct cg_path_t * path);
+void cg_fill_path(struct cg_ctx_t * ctx, struct cg_path_t * path);
+void cg_fill_instances_path(struct cg_ctx_t * ctx, struct cg_path_t * path, const struct cg_point_t * offsets, int count);
+void cg_stroke_path(struct cg_ctx_t * ctx, struct cg_path_t * path);
+void cg_fill_extents(struct cg_ctx_t * ctx, struct cg_rect_t * extents);
+void cg_stroke_extents(struct cg_ctx_t * ctx, struct cg_rect_t * extents);
+void cg_fill_extents_tight(struct cg_ctx_t * ctx, struct cg_rect_t * extents);
+void cg_stroke_extents_tight(struct cg_ctx_t * ctx, struct cg_rect_t * extents);
+void cg_fill_extents_path(struct cg_ctx_t * ctx, struct cg_path_t * path, struct cg_rect_t * extents);
+void cg_stroke_extents_path(struct cg_ctx_t * ctx, struct cg_path_t * path, struct cg_rect_t * extents);
+void cg_fill_extents_tight_path(struct cg_ctx_t * ctx, struct cg_path_t * path, struct cg_rect_t * extents);
+void cg_stroke_extents_tight_path(struct cg_ctx_t * ctx, struct cg_path_t * path, struct cg_rect_t * extents);
+int cg_in_fill(struct cg_ctx_t * ctx, double x, double y);
+int cg_in_stroke(struct cg_ctx_t * ctx, double x, double y);
 
 #ifdef __cplusplus
 }
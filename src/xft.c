@@ -899,7 +899,7 @@ static void gray_split_cubic(XCG_FT_Vector * base)
 	base[3].y = (a + b) / 2;
 }
 
-static void gray_render_cubic(RAS_ARG_ const XCG_FT_Vector * control1, const XCG_FT_Vector * control2, const XCG_FT_Vector * to)
+static void gray_bisect_cubic(RAS_ARG_ const XCG_FT_Vector * base)
 {
 	XCG_FT_Vector bez_stack[16 * 3 + 1];
 	XCG_FT_Vector * arc = bez_stack;
@@ -907,27 +907,10 @@ static void gray_render_cubic(RAS_ARG_ const XCG_FT_Vector * control1, const XCG
 	TPos dx1, dy1, dx2, dy2;
 	TPos L, s, s_limit;
 
-	arc[0].x = UPSCALE(to->x);
-	arc[0].y = UPSCALE(to->y);
-	arc[1].x = UPSCALE(control2->x);
-	arc[1].y = UPSCALE(control2->y);
-	arc[2].x = UPSCALE(control1->x);
-	arc[2].y = UPSCALE(control1->y);
-	arc[3].x = ras.x;
-	arc[3].y = ras.y;
-
-	if(( TRUNC( arc[0].y ) >= ras.max_ey &&
-		TRUNC( arc[1].y ) >= ras.max_ey &&
-		TRUNC( arc[2].y ) >= ras.max_ey &&
-		TRUNC( arc[3].y ) >= ras.max_ey) || ( TRUNC( arc[0].y ) < ras.min_ey &&
-		TRUNC( arc[1].y ) < ras.min_ey &&
-		TRUNC( arc[2].y ) < ras.min_ey &&
-		TRUNC( arc[3].y ) < ras.min_ey))
-	{
-		ras.x = arc[0].x;
-		ras.y = arc[0].y;
-		return;
-	}
+	arc[0] = base[0];
+	arc[1] = base[1];
+	arc[2] = base[2];
+	arc[3] = base[3];
 	for(;;)
 	{
 		dx = dx_ = arc[3].x - arc[0].x;
@@ -959,6 +942,107 @@ Split:
 	}
 }
 
+/*
+ * The step count comes once from the control point deviation: 2^shift uniform steps keep the
+ * curve within 3/4 * dev / 4^shift of its chords (Wang's formula), each doubling gains 4. The
+ * points are then stepped with forward differences scaled by 2^(3 * shift), which is exact in
+ * integers, so no error builds up along the curve. Points are kept relative to the start, and
+ * curves too large or too bent for that to fit in 64 bits are bisected instead.
+ */
+#define XCG_FT_CUBIC_MAX_SHIFT	8
+
+static void gray_render_cubic(RAS_ARG_ const XCG_FT_Vector * control1, const XCG_FT_Vector * control2, const XCG_FT_Vector * to)
+{
+	XCG_FT_Vector arc[4];
+	TPos dev, ddx, ddy, ext;
+	int shift;
+
+	arc[0].x = UPSCALE(to->x);
+	arc[0].y = UPSCALE(to->y);
+	arc[1].x = UPSCALE(control2->x);
+	arc[1].y = UPSCALE(control2->y);
+	arc[2].x = UPSCALE(control1->x);
+	arc[2].y = UPSCALE(control1->y);
+	arc[3].x = ras.x;
+	arc[3].y = ras.y;
+
+	if(( TRUNC( arc[0].y ) >= ras.max_ey &&
+		TRUNC( arc[1].y ) >= ras.max_ey &&
+		TRUNC( arc[2].y ) >= ras.max_ey &&
+		TRUNC( arc[3].y ) >= ras.max_ey) || ( TRUNC( arc[0].y ) < ras.min_ey &&
+		TRUNC( arc[1].y ) < ras.min_ey &&
+		TRUNC( arc[2].y ) < ras.min_ey &&
+		TRUNC( arc[3].y ) < ras.min_ey))
+	{
+		ras.x = arc[0].x;
+		ras.y = arc[0].y;
+		return;
+	}
+
+	ddx = XCG_FT_ABS(arc[3].x - 2 * arc[2].x + arc[1].x);
+	ddy = XCG_FT_ABS(arc[3].y - 2 * arc[2].y + arc[1].y);
+	dev = ddx + ddy;
+	ddx = XCG_FT_ABS(arc[2].x - 2 * arc[1].x + arc[0].x);
+	ddy = XCG_FT_ABS(arc[2].y - 2 * arc[1].y + arc[0].y);
+	if(dev < ddx + ddy)
+		dev = ddx + ddy;
+	dev = dev / 4 * 3;
+	shift = 0;
+	while(dev > ONE_PIXEL / 8)
+	{
+		dev >>= 2;
+		shift++;
+	}
+	ext = 0;
+	for(int i = 0; i < 3; i++)
+	{
+		ext |= XCG_FT_ABS(arc[i].x - arc[3].x);
+		ext |= XCG_FT_ABS(arc[i].y - arc[3].y);
+	}
+	if((shift > XCG_FT_CUBIC_MAX_SHIFT) || (ext >= (1L << 30)))
+	{
+		gray_bisect_cubic( RAS_VAR_ arc);
+		return;
+	}
+	if(shift == 0)
+	{
+		gray_render_line( RAS_VAR_ arc[0].x, arc[0].y);
+		return;
+	}
+
+	int s1 = shift, s2 = shift * 2, s3 = shift * 3;
+	int n = 1 << shift;
+	XCG_FT_Int64 half = (XCG_FT_Int64)1 << (s3 - 1);
+	XCG_FT_Int64 ax = (XCG_FT_Int64)arc[0].x - arc[3].x + 3 * ((XCG_FT_Int64)arc[2].x - arc[1].x);
+	XCG_FT_Int64 ay = (XCG_FT_Int64)arc[0].y - arc[3].y + 3 * ((XCG_FT_Int64)arc[2].y - arc[1].y);
+	XCG_FT_Int64 bx = 3 * ((XCG_FT_Int64)arc[3].x - 2 * arc[2].x + arc[1].x);
+	XCG_FT_Int64 by = 3 * ((XCG_FT_Int64)arc[3].y - 2 * arc[2].y + arc[1].y);
+	XCG_FT_Int64 cx = 3 * ((XCG_FT_Int64)arc[2].x - arc[3].x);
+	XCG_FT_Int64 cy = 3 * ((XCG_FT_Int64)arc[2].y - arc[3].y);
+	XCG_FT_Int64 px = half;
+	XCG_FT_Int64 py = half;
+	XCG_FT_Int64 k1 = (XCG_FT_Int64)1 << s1;
+	XCG_FT_Int64 k2 = (XCG_FT_Int64)1 << s2;
+	XCG_FT_Int64 d1x = ax + bx * k1 + cx * k2;
+	XCG_FT_Int64 d1y = ay + by * k1 + cy * k2;
+	XCG_FT_Int64 d2x = 6 * ax + bx * k1 * 2;
+	XCG_FT_Int64 d2y = 6 * ay + by * k1 * 2;
+	XCG_FT_Int64 d3x = 6 * ax;
+	XCG_FT_Int64 d3y = 6 * ay;
+
+	while(--n)
+	{
+		px += d1x;
+		py += d1y;
+		d1x += d2x;
+		d1y += d2y;
+		d2x += d3x;
+		d2y += d3y;
+		gray_render_line( RAS_VAR_ arc[3].x + (TPos)(px >> s3), arc[3].y + (TPos)(py >> s3));
+	}
+	gray_render_line( RAS_VAR_ arc[0].x, arc[0].y);
+}
+
 static int gray_move_to(const XCG_FT_Vector *to, PWorker worker)
 {
 	TPos x, y;
@@ -1656,6 +1740,172 @@ void XCG_FT_Outline_Get_CBox(const XCG_FT_Outline * outline, XCG_FT_BBox * acbox
 	}
 }
 
+static void ft_bbox_add(XCG_FT_BBox * bbox, double x, double y)
+{
+	XCG_FT_Pos x1 = (XCG_FT_Pos)floor(x), x2 = (XCG_FT_Pos)ceil(x);
+	XCG_FT_Pos y1 = (XCG_FT_Pos)floor(y), y2 = (XCG_FT_Pos)ceil(y);
+	if(x1 < bbox->xMin)
+		bbox->xMin = x1;
+	if(x2 > bbox->xMax)
+		bbox->xMax = x2;
+	if(y1 < bbox->yMin)
+		bbox->yMin = y1;
+	if(y2 > bbox->yMax)
+		bbox->yMax = y2;
+}
+
+/*
+ * The roots in (0, 1) of the derivative of one coordinate of a bezier, a * t^2 + b * t + c
+ */
+static int ft_bbox_roots(double a, double b, double c, double * t)
+{
+	int n = 0;
+	if(a == 0)
+	{
+		if(b != 0)
+			t[n++] = -c / b;
+	}
+	else
+	{
+		double d = b * b - 4 * a * c;
+		if(d >= 0)
+		{
+			d = sqrt(d);
+			t[n++] = (-b + d) / (2 * a);
+			t[n++] = (-b - d) / (2 * a);
+		}
+	}
+	int k = 0;
+	for(int i = 0; i < n; i++)
+	{
+		if((t[i] > 0) && (t[i] < 1))
+			t[k++] = t[i];
+	}
+	return k;
+}
+
+static void ft_bbox_conic(XCG_FT_BBox * bbox, const XCG_FT_Vector * p0, const XCG_FT_Vector * c, const XCG_FT_Vector * p1)
+{
+	double t[2];
+	ft_bbox_add(bbox, p1->x, p1->y);
+	if((c->x < bbox->xMin) || (c->x > bbox->xMax) || (c->y < bbox->yMin) || (c->y > bbox->yMax))
+	{
+		int n = ft_bbox_roots(0, 2.0 * ((double)p0->x - 2.0 * c->x + p1->x), 2.0 * ((double)c->x - p0->x), t);
+		n += ft_bbox_roots(0, 2.0 * ((double)p0->y - 2.0 * c->y + p1->y), 2.0 * ((double)c->y - p0->y), t + n);
+		for(int i = 0; i < n; i++)
+		{
+			double u = 1 - t[i];
+			ft_bbox_add(bbox, u * u * p0->x + 2 * u * t[i] * c->x + t[i] * t[i] * p1->x,
+				u * u * p0->y + 2 * u * t[i] * c->y + t[i] * t[i] * p1->y);
+		}
+	}
+}
+
+static void ft_bbox_cubic(XCG_FT_BBox * bbox, const XCG_FT_Vector * p0, const XCG_FT_Vector * c1, const XCG_FT_Vector * c2, const XCG_FT_Vector * p1)
+{
+	double t[4];
+	ft_bbox_add(bbox, p1->x, p1->y);
+	if((c1->x < bbox->xMin) || (c1->x > bbox->xMax) || (c1->y < bbox->yMin) || (c1->y > bbox->yMax)
+		|| (c2->x < bbox->xMin) || (c2->x > bbox->xMax) || (c2->y < bbox->yMin) || (c2->y > bbox->yMax))
+	{
+		int n = ft_bbox_roots(3.0 * c1->x - 3.0 * c2->x + p1->x - p0->x, 2.0 * ((double)p0->x - 2.0 * c1->x + c2->x), (double)c1->x - p0->x, t);
+		n += ft_bbox_roots(3.0 * c1->y - 3.0 * c2->y + p1->y - p0->y, 2.0 * ((double)p0->y - 2.0 * c1->y + c2->y), (double)c1->y - p0->y, t + n);
+		for(int i = 0; i < n; i++)
+		{
+			double u = 1 - t[i];
+			double a = u * u * u, b = 3 * u * u * t[i], c = 3 * u * t[i] * t[i], d = t[i] * t[i] * t[i];
+			ft_bbox_add(bbox, a * p0->x + b * c1->x + c * c2->x + d * p1->x, a * p0->y + b * c1->y + c * c2->y + d * p1->y);
+		}
+	}
+}
+
+/*
+ * The exact box of the outline, with curves bounded at their extrema rather than at the control points,
+ * walking the contours as XCG_FT_Outline_Decompose does
+ */
+void XCG_FT_Outline_Get_BBox(const XCG_FT_Outline * outline, XCG_FT_BBox * abbox)
+{
+	if(outline && abbox)
+	{
+		XCG_FT_BBox bbox = { LONG_MAX, LONG_MAX, LONG_MIN, LONG_MIN };
+		int first = 0;
+		for(int n = 0; n < outline->n_contours; n++)
+		{
+			int last = outline->contours[n];
+			XCG_FT_Vector * points = outline->points;
+			char * tags = outline->tags;
+			XCG_FT_Vector v_start, v_last, v_control, v_middle;
+			int i = first, end = last;
+			if(last < first)
+				break;
+			if(XCG_FT_CURVE_TAG(tags[first]) == XCG_FT_CURVE_TAG_ON)
+			{
+				v_start = points[first];
+				i++;
+			}
+			else if(XCG_FT_CURVE_TAG(tags[last]) == XCG_FT_CURVE_TAG_ON)
+			{
+				v_start = points[last];
+				end--;
+			}
+			else
+			{
+				v_start.x = (points[first].x + points[last].x) / 2;
+				v_start.y = (points[first].y + points[last].y) / 2;
+			}
+			ft_bbox_add(&bbox, v_start.x, v_start.y);
+			v_last = v_start;
+			while(i <= end)
+			{
+				char tag = XCG_FT_CURVE_TAG(tags[i]);
+				if(tag == XCG_FT_CURVE_TAG_ON)
+				{
+					v_last = points[i++];
+					ft_bbox_add(&bbox, v_last.x, v_last.y);
+				}
+				else if(tag == XCG_FT_CURVE_TAG_CONIC)
+				{
+					v_control = points[i++];
+					while((i <= end) && (XCG_FT_CURVE_TAG(tags[i]) == XCG_FT_CURVE_TAG_CONIC))
+					{
+						v_middle.x = (v_control.x + points[i].x) / 2;
+						v_middle.y = (v_control.y + points[i].y) / 2;
+						ft_bbox_conic(&bbox, &v_last, &v_control, &v_middle);
+						v_last = v_middle;
+						v_control = points[i++];
+					}
+					v_middle = (i <= end) ? points[i++] : v_start;
+					ft_bbox_conic(&bbox, &v_last, &v_control, &v_middle);
+					v_last = v_middle;
+				}
+				else
+				{
+					if(i + 1 > end)
+					{
+						ft_bbox_add(&bbox, points[i].x, points[i].y);
+						break;
+					}
+					XCG_FT_Vector * v1 = &points[i];
+					XCG_FT_Vector * v2 = &points[i + 1];
+					i += 2;
+					v_middle = (i <= end) ? points[i++] : v_start;
+					ft_bbox_cubic(&bbox, &v_last, v1, v2, &v_middle);
+					v_last = v_middle;
+				}
+			}
+			first = last + 1;
+		}
+		if(bbox.xMin > bbox.xMax)
+		{
+			bbox.xMin = 0;
+			bbox.yMin = 0;
+			bbox.xMax = 0;
+			bbox.yMax = 0;
+		}
+		*abbox = bbox;
+	}
+}
+
 static XCG_FT_Error ft_stroke_border_grow(XCG_FT_StrokeBorder border, XCG_FT_UInt new_points)
 {
 	XCG_FT_UInt old_max = border->max_points;
@@ -105,6 +105,7 @@ typedef struct XCG_FT_Raster_Params_ {
 
 XCG_FT_Error XCG_FT_Outline_Check(XCG_FT_Outline * outline);
 void XCG_FT_Outline_Get_CBox(const XCG_FT_Outline * outline, XCG_FT_BBox * acbox);
+void XCG_FT_Outline_Get_BBox(const XCG_FT_Outline * outline, XCG_FT_BBox * abbox);
 void XCG_FT_Raster_Render(const XCG_FT_Raster_Params * params);
 
 /*